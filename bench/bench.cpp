@@ -0,0 +1,405 @@
+// Headless benchmarks of the editor's hot paths, run with `make bench`.
+//
+// Synthetic C++ and log corpora are generated into a scratch directory and
+// every benchmark reports its wall time as one JSON object, so results can
+// be compared between builds. Drawing goes through a real curses screen
+// created with newterm on /dev/null.
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "tide.hpp"
+#include "scan.hpp"
+#include "thread_pool.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Options {
+    size_t size_mb = 64;
+    size_t edits = 20000;
+    size_t frames = 200;
+    unsigned seed = 1;
+    int rows = 40;
+    int cols = 120;
+    std::string dir;
+    std::string out;
+};
+
+// Collects results and prints them as JSON.
+class Report {
+public:
+    // `bytes` gives a throughput, `ops` a per-operation time; either may be 0.
+    void add(const std::string& name, double seconds, uint64_t bytes, uint64_t ops) {
+        results.push_back({name, seconds, bytes, ops});
+        fprintf(stderr, "  %-24s %9.3f ms", name.c_str(), seconds * 1e3);
+        if(bytes) fprintf(stderr, "  %9.1f MB/s", bytes / seconds / 1e6);
+        if(ops) fprintf(stderr, "  %9.2f us/op", seconds / ops * 1e6);
+        fprintf(stderr, "\n");
+    }
+
+    void write(FILE* f, const Options& opt) const {
+        fprintf(f, "{\n  \"isa\": \"%s\",\n  \"threads\": %zu,\n", scan_isa(),
+                ThreadPool::shared().threads());
+        fprintf(f, "  \"corpus_mb\": %zu,\n  \"seed\": %u,\n  \"screen\": [%d, %d],\n",
+                opt.size_mb, opt.seed, opt.cols, opt.rows);
+        fprintf(f, "  \"results\": [\n");
+        for(size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            fprintf(f, "    {\"name\": \"%s\", \"seconds\": %.6f", r.name.c_str(), r.seconds);
+            if(r.bytes) {
+                fprintf(f, ", \"bytes\": %llu, \"mb_per_s\": %.1f",
+                        static_cast<unsigned long long>(r.bytes), r.bytes / r.seconds / 1e6);
+            }
+            if(r.ops) {
+                fprintf(f, ", \"ops\": %llu, \"us_per_op\": %.3f",
+                        static_cast<unsigned long long>(r.ops), r.seconds / r.ops * 1e6);
+            }
+            fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+    }
+
+private:
+    struct Result {
+        std::string name;
+        double seconds;
+        uint64_t bytes;
+        uint64_t ops;
+    };
+    std::vector<Result> results;
+};
+
+// Corpora
+
+// Random number in [0, n). Values are drawn into locals before use, since
+// the order in which function arguments are evaluated is unspecified.
+static unsigned pick(std::mt19937& rng, unsigned n) {
+    return static_cast<unsigned>(rng() % n);
+}
+
+static void write_cpp_corpus(const std::string& path, size_t bytes, std::mt19937& rng) {
+    static const char* const types[] = {"int", "double", "std::string", "size_t", "auto"};
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f) return;
+    size_t written = 0;
+    for(size_t n = 0; written < bytes; n++) {
+        const char* type = types[pick(rng, 5)];
+        unsigned init = pick(rng, 1000);
+        unsigned of = pick(rng, 100);
+        unsigned loops = pick(rng, 64);
+        unsigned scale = pick(rng, 10);
+        written += fprintf(f,
+            "#include <vector>\n"
+            "// Function number %zu, generated for the benchmark\n"
+            "/* Block comments span\n"
+            "   several lines with \"quotes\" and 'chars' inside */\n"
+            "static %s compute_%zu(const std::vector<int>& values, const char* name) {\n"
+            "    %s total = %u;\n"
+            "    std::string label = \"item \\\"%zu\\\" of %u\";\n"
+            "    char sep = '\\n';\n"
+            "    for (int i = 0; i < %u; i++) {\n"
+            "        total += values[i] * %u.5; // scale\n"
+            "    }\n"
+            "    if (name == nullptr) return total;\n"
+            "    return total + label.size() + sep;\n"
+            "}\n\n",
+            n, type, n, type, init, n, of, loops, scale);
+    }
+    fclose(f);
+}
+
+static void write_log_corpus(const std::string& path, size_t bytes, std::mt19937& rng) {
+    static const char* const levels[] = {"INFO ", "DEBUG", "WARN ", "ERROR"};
+    static const char* const paths[] = {"/api/v1/items", "/api/v1/users", "/health", "/static/app.js"};
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f) return;
+    size_t written = 0;
+    for(size_t n = 0; written < bytes; n++) {
+        unsigned ms = static_cast<unsigned>(n % 86400000);
+        const char* level = levels[pick(rng, 4)];
+        unsigned worker = pick(rng, 16);
+        const char* url = paths[pick(rng, 4)];
+        unsigned status = pick(rng, 3) ? 200 : 500;
+        unsigned latency = pick(rng, 500);
+        unsigned tenths = pick(rng, 10);
+        written += fprintf(f,
+            "2026-01-01T%02u:%02u:%02u.%03uZ %s [worker-%u] request id=%zu path=%s "
+            "status=%u latency_ms=%u.%u\n",
+            ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000, level,
+            worker, n, url, status, latency, tenths);
+    }
+    fclose(f);
+}
+
+// Benchmarks that need the editor's internals
+
+class TideBench {
+public:
+    TideBench(const std::string& path, const Options& opt) : opt(opt), editor(path.c_str()) {
+        editor.load_file();
+        editor.buffer.wait_for_index();
+    }
+
+    // The edits are never saved; their journal must not outlive the run
+    ~TideBench() {
+        if(editor.journal) editor.journal->discard();
+    }
+
+    // Full repaints of random screens, after the highlighter has caught up
+    // so that every row is drawn with its final colors.
+    void draw(Report& report, const std::string& name, std::mt19937& rng) {
+        double total = 0;
+        size_t lines = editor.buffer.line_count();
+        for(size_t i = 0; i < opt.frames; i++) {
+            editor.cursor_y = pick(rng, lines);
+            editor.cursor_x = 0;
+            settle();
+            editor.full_redraw = true;
+            Clock::time_point start = Clock::now();
+            editor.draw_frame();
+            total += seconds_since(start);
+        }
+        report.add(name, total, 0, opt.frames);
+    }
+
+    // Random typing, newlines and backspaces. "edit" times the buffer and
+    // cache updates alone, "keystroke" also draws the frame that follows.
+    void edit(Report& report, std::mt19937& rng, bool with_frame) {
+        Tide& t = editor;
+        t.mode = Tide::INSERT;
+        double total = 0;
+        size_t lines = t.buffer.line_count();
+        for(size_t i = 0; i < opt.edits; i++) {
+            // Bursts of a few keys at one spot, like real typing
+            if(i % 16 == 0) {
+                t.cursor_y = pick(rng, lines);
+                t.cursor_x = pick(rng, t.buffer.line_length(t.cursor_y) + 1);
+                t.adjust_cursor_x();
+                if(with_frame) t.draw_frame();
+            }
+            unsigned kind = pick(rng, 10);
+            Clock::time_point start = Clock::now();
+            if(kind == 0) t.handle_newline();
+            else if(kind <= 2) t.handle_backspace();
+            else t.handle_insert_mode('a' + kind);
+            if(with_frame) t.draw_frame();
+            total += seconds_since(start);
+            lines = t.buffer.line_count();
+        }
+        t.mode = Tide::COMMAND;
+        report.add(with_frame ? "keystroke" : "edit", total, 0, opt.edits);
+    }
+
+private:
+    const Options& opt;
+    Tide editor;
+
+    void settle() {
+        editor.draw_frame();
+        while(editor.syntax_cache.busy()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            editor.draw_frame();
+        }
+    }
+};
+
+static void bench_load(Report& report, const std::string& name, const std::string& path,
+                       uint64_t bytes, const Options& opt) {
+    TextBuffer buffer;
+    Clock::time_point start = Clock::now();
+    buffer.load(path);
+    // First screen readable, as when the editor opens the file
+    for(int y = 0; y < opt.rows; y++) buffer.line(y);
+    report.add(name + ".first_screen", seconds_since(start), 0, 0);
+    buffer.wait_for_index();
+    report.add(name, seconds_since(start), bytes, 0);
+}
+
+static void bench_save(Report& report, const std::string& name, const std::string& path,
+                       uint64_t bytes, const std::string& dir) {
+    TextBuffer buffer;
+    buffer.load(path);
+    // A few edits so the output mixes mapped and owned pieces
+    for(size_t y = 0; y < buffer.line_count(); y += 1000) buffer.insert(y, 0, "// edited\n");
+    std::string target = dir + "/save.out";
+    TextBuffer::Snapshot snapshot = buffer.snapshot();
+    Clock::time_point start = Clock::now();
+    snapshot.save(target);
+    report.add(name, seconds_since(start), bytes, 0);
+    unlink(target.c_str());
+}
+
+static void bench_highlight(Report& report, const std::string& name, const std::string& path,
+                            uint64_t bytes) {
+    TextBuffer buffer;
+    buffer.load(path);
+    buffer.wait_for_index();
+    SyntaxHighlighter highlighter;
+    SyntaxState state;
+    std::vector<HighlightSpan> spans;
+    size_t lines = buffer.line_count();
+    Clock::time_point start = Clock::now();
+    for(size_t y = 0; y < lines; y++) {
+        spans.clear();
+        highlighter.highlight(buffer.line(y), state, spans);
+    }
+    report.add(name, seconds_since(start), bytes, 0);
+}
+
+// Counting the words of a file in the background, then completing random
+// prefixes of them and counting edited lines one at a time.
+static void bench_words(Report& report, const std::string& name, const std::string& path,
+                        uint64_t bytes, std::mt19937& rng) {
+    TextBuffer buffer;
+    buffer.load(path);
+    buffer.wait_for_index();
+    WordIndex words;
+    Clock::time_point start = Clock::now();
+    words.rebuild(buffer.snapshot());
+    while(!words.ready()) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    report.add(name + ".count", seconds_since(start), bytes, 0);
+
+    std::vector<std::string> prefixes;
+    size_t lines = buffer.line_count();
+    while(prefixes.size() < 10000) {
+        WordIndex::for_each_word(buffer.line(rng() % lines), [&](std::string_view word) {
+            prefixes.emplace_back(word.substr(0, 1 + rng() % 3));
+        });
+    }
+    std::vector<std::string> found;
+    start = Clock::now();
+    for(const std::string& prefix : prefixes) words.complete(prefix, COMPLETION_ITEMS, found);
+    report.add(name + ".complete", seconds_since(start), 0, prefixes.size());
+
+    const size_t edits = 10000;
+    start = Clock::now();
+    for(size_t i = 0; i < edits; i++) {
+        std::string_view line = buffer.line(rng() % lines);
+        words.remove_line(line);
+        words.add_line(line);
+    }
+    report.add(name + ".edit_line", seconds_since(start), 0, edits);
+}
+
+static uint64_t file_size(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if(!f) return 0;
+    fseek(f, 0, SEEK_END);
+    uint64_t size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: tide-bench [--size MB] [--edits N] [--frames N] [--seed N]\n"
+        "                  [--screen COLSxROWS] [--dir DIR] [--out FILE]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) usage();
+        const char* value = argv[++i];
+        if(arg == "--size") opt.size_mb = strtoull(value, nullptr, 10);
+        else if(arg == "--edits") opt.edits = strtoull(value, nullptr, 10);
+        else if(arg == "--frames") opt.frames = strtoull(value, nullptr, 10);
+        else if(arg == "--seed") opt.seed = strtoul(value, nullptr, 10);
+        else if(arg == "--dir") opt.dir = value;
+        else if(arg == "--out") opt.out = value;
+        else if(arg == "--screen") {
+            if(sscanf(value, "%dx%d", &opt.cols, &opt.rows) != 2) usage();
+        } else {
+            usage();
+        }
+    }
+
+    bool own_dir = opt.dir.empty();
+    if(own_dir) {
+        char tmpl[] = "/tmp/tide-bench-XXXXXX";
+        if(!mkdtemp(tmpl)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        opt.dir = tmpl;
+    }
+
+    std::mt19937 rng(opt.seed);
+    uint64_t target = uint64_t(opt.size_mb) << 20;
+    std::string cpp = opt.dir + "/corpus.cpp";
+    std::string log = opt.dir + "/corpus.log";
+    fprintf(stderr, "generating %zu MB corpora in %s\n", opt.size_mb, opt.dir.c_str());
+    write_cpp_corpus(cpp, target, rng);
+    write_log_corpus(log, target, rng);
+    uint64_t cpp_bytes = file_size(cpp);
+    uint64_t log_bytes = file_size(log);
+    if(!cpp_bytes || !log_bytes) {
+        fprintf(stderr, "cannot write corpora in %s\n", opt.dir.c_str());
+        return 1;
+    }
+
+    Report report;
+    fprintf(stderr, "scan kernel %s, %zu threads\n", scan_isa(), ThreadPool::shared().threads());
+    bench_load(report, "load.cpp", cpp, cpp_bytes, opt);
+    bench_load(report, "load.log", log, log_bytes, opt);
+    bench_save(report, "save.cpp", cpp, cpp_bytes, opt.dir);
+    bench_highlight(report, "highlight.cpp", cpp, cpp_bytes);
+    bench_highlight(report, "highlight.log", log, log_bytes);
+    bench_words(report, "words.cpp", cpp, cpp_bytes, rng);
+
+    // The curses screen writes to /dev/null, at a fixed size
+    setlocale(LC_ALL, "");
+    setenv("LINES", std::to_string(opt.rows).c_str(), 1);
+    setenv("COLUMNS", std::to_string(opt.cols).c_str(), 1);
+    const char* term = getenv("TERM");
+    if(!term || !*term || !strcmp(term, "dumb")) term = "xterm-256color";
+    FILE* out = fopen("/dev/null", "w");
+    FILE* in = fopen("/dev/null", "r");
+    SCREEN* screen = out && in ? newterm(term, out, in) : nullptr;
+    if(!screen) {
+        fprintf(stderr, "cannot open a curses screen for %s\n", term);
+        return 1;
+    }
+    set_term(screen);
+    {
+        TideBench bench(cpp, opt);
+        bench.draw(report, "draw.cpp", rng);
+        bench.edit(report, rng, false);
+        bench.edit(report, rng, true);
+    }
+    {
+        TideBench bench(log, opt);
+        bench.draw(report, "draw.log", rng);
+    }
+    endwin();
+    delscreen(screen);
+    fclose(out);
+    fclose(in);
+
+    if(own_dir) {
+        unlink(cpp.c_str());
+        unlink(log.c_str());
+        rmdir(opt.dir.c_str());
+    }
+
+    FILE* json = opt.out.empty() ? stdout : fopen(opt.out.c_str(), "w");
+    if(!json) {
+        perror(opt.out.c_str());
+        return 1;
+    }
+    report.write(json, opt);
+    if(json != stdout) fclose(json);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "line_block.hpp"
+#include "line_index.hpp"
+#include "mapped_file.hpp"
+#include "sidecar.hpp"
+
+// Line-oriented piece table. The original file is memory-mapped and
+// addressed through a line-offset index that is built in the background;
+// lines only become owned strings once they are edited. Pieces live in an
+// implicit treap keyed by line count, so lookups, inserts, deletes and line
+// splits are O(log n). Once many lines are owned, pack() compresses runs
+// of them away from the cursor into LineBlocks, which pieces then address
+// like the original file.
+//
+// The treap is persistent: nodes are immutable and edits copy the path they
+// touch, so a Snapshot of the whole buffer costs O(1) and can be read from
+// another thread while the buffer keeps changing.
+//
+// Original lines past the end of the treap that have not been touched yet
+// form the "tail": it grows as the index advances and is attached to the
+// treap as a single ORIGINAL piece right before an edit.
+class TextBuffer {
+    struct Node;
+    struct Original;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+public:
+    // Byte counts of a save in progress, readable from any thread.
+    struct SaveProgress {
+        std::atomic<uint64_t> written{0};
+        std::atomic<uint64_t> total{0};
+        int error = 0;  // errno of the step that failed
+    };
+
+    // Lines [y, y + lines) stored contiguously, separated by '\n'. Runs of
+    // unedited lines point straight into the mapping, so scans over them
+    // need not go line by line. Runs of packed lines come without their
+    // text, so that nobody holds more blocks than it is reading: decoded()
+    // fills it in for as long as the copy lives.
+    struct TextRun {
+        size_t y;
+        size_t lines;
+        std::string_view text;
+        const LineIndex* index = nullptr;  // set for runs of original lines
+        size_t first = 0;                  // original or block line number of y
+        const LineBlock* block = nullptr;  // set for runs of packed lines
+        std::shared_ptr<const std::string> keep = nullptr;  // decoded block behind `text`
+
+        // Splits an offset into `text` into a line and column.
+        void position(size_t offset, size_t& line, size_t& column) const;
+        // Offset of line y + i in `text`, for i <= lines.
+        size_t line_start(size_t i) const;
+        // Size of `text`, also before a packed run is decoded.
+        size_t bytes() const { return block ? line_start(lines) : text.size(); }
+        // This run with its text; decodes the block of a packed run.
+        TextRun decoded() const;
+    };
+
+    // New contents of line y, for replace_lines().
+    struct LineEdit {
+        size_t y;
+        std::string text;
+    };
+
+    // Stretch of the buffer for restore(): `count` lines of the loaded file
+    // from line `first`, or when `text` is set, the `count` lines in it,
+    // each ending in '\n'.
+    struct Part {
+        size_t first;
+        size_t count;
+        std::string text;
+    };
+
+    // Immutable view of the buffer at one point in time.
+    class Snapshot {
+    public:
+        size_t line_count() const { return lines_of(root) + (tail_end - tail_first); }
+        std::string_view line(size_t y) const;
+        bool save(const std::string& path, SaveProgress* progress = nullptr) const;
+        // Appends the runs covering the whole buffer, in order. Packed runs
+        // are left to be decoded one at a time as they are read.
+        void runs(std::vector<TextRun>& out) const;
+        // Only the runs of original lines, without reading any others.
+        void original_runs(std::vector<TextRun>& out) const;
+
+    private:
+        friend class TextBuffer;
+        NodePtr root;
+        std::shared_ptr<const Original> original;
+        size_t tail_first = 0;
+        size_t tail_end = 0;
+    };
+
+    TextBuffer();
+    TextBuffer(const TextBuffer&) = delete;
+    TextBuffer& operator=(const TextBuffer&) = delete;
+
+    // With `sidecar`, the line index is taken from a matching Sidecar if
+    // there is one instead of being built. With `copy`, the file is read
+    // into memory rather than mapped, see MappedFile.
+    bool load(const std::string& path, bool sidecar = false, bool copy = false);
+    // Trades the mapping of the loaded file for a copy, for a file that may
+    // be truncated from now on.
+    bool copy_original() { return original->file.copy(); }
+    bool save(const std::string& path) const;
+    void clear();
+    Snapshot snapshot() const;
+
+    // Lines known so far; grows while the index is still being built.
+    size_t line_count() const;
+    bool indexing() const { return !original->index.done(); }
+    void wait_for_index() const { original->index.wait(); }
+    // Size of the loaded file, before any edits.
+    size_t original_size() const { return original->file.size(); }
+    bool from_sidecar() const { return original->sidecar.lines() > 0; }
+    // Rough footprint: the mapped file and its line index.
+    size_t memory() const { return original->file.size() + original->index.lines() * sizeof(uint64_t); }
+    // Exchanges contents with another buffer in O(1).
+    void swap(TextBuffer& other);
+    // Syntax states stored with the sidecar the index came from, if any.
+    bool sidecar_states(std::vector<uint8_t>& states) const;
+    // Stores the finished index of the loaded file, and `states` unless
+    // empty, for the next load of the same file.
+    bool write_sidecar(const std::string& path, const std::vector<uint8_t>& states) const;
+    // The view stays valid until the next mutation of the buffer, or for a
+    // packed line until the thread has read HOT_BLOCKS other LineBlocks.
+    std::string_view line(size_t y) const;
+    size_t line_length(size_t y) const { return line(y).size(); }
+
+    // Inserts text at (y, x); embedded '\n' characters split lines.
+    void insert(size_t y, size_t x, std::string_view text);
+    // Removes the text between (y, x) and (end_y, end_x), joining lines.
+    void erase(size_t y, size_t x, size_t end_y, size_t end_x);
+    // Replaces whole lines in one pass over the affected part of the tree.
+    // `edits` must be sorted by line, without duplicates.
+    void replace_lines(std::vector<LineEdit> edits);
+
+    // Owned lines made since the last pack(), roughly.
+    size_t loose_lines() const { return loose; }
+    // Compresses runs of owned lines outside [hot_first, hot_first +
+    // hot_count) into LineBlocks. Runs too short to fill a useful block
+    // stay as they are.
+    void pack(size_t hot_first, size_t hot_count);
+    // Replaces the contents with `parts` in order; false, leaving the
+    // buffer as it was, if a part refers past the loaded file.
+    bool restore(const std::vector<Part>& parts);
+    // Returns the text between (y, x) and (end_y, end_x) with '\n' separators.
+    std::string text(size_t y, size_t x, size_t end_y, size_t end_x) const;
+
+private:
+    struct Piece {
+        enum Kind : uint8_t { ORIGINAL, OWNED, PACKED } kind;
+        size_t first;      // ORIGINAL, PACKED: first line in the file or block
+        size_t count;      // number of lines covered by the piece
+        std::string text;  // OWNED: the line contents
+        std::shared_ptr<const LineBlock> block = nullptr;  // PACKED
+
+        // Lines [from, from + n) of an ORIGINAL or PACKED piece.
+        Piece slice(size_t from, size_t n) const { return {kind, first + from, n, {}, block}; }
+    };
+
+    struct Node {
+        Piece piece;
+        uint32_t priority;
+        size_t lines;      // lines in this subtree
+        NodePtr left;
+        NodePtr right;
+    };
+
+    // The mapped file and its index, shared with snapshots so they keep
+    // the mapping alive across a reload.
+    struct Original {
+        MappedFile file;
+        Sidecar sidecar;  // empty unless the index came from it
+        LineIndex index;
+        bool final_newline = true;  // false if the file's last line had none
+    };
+
+    NodePtr root;
+    std::shared_ptr<Original> original;
+    size_t tail_first;  // first original line not yet attached to the treap
+    size_t loose;
+    uint32_t seed;
+
+    NodePtr make_node(Piece piece);
+    static NodePtr make_node(Piece piece, uint32_t priority, NodePtr left, NodePtr right);
+    static size_t lines_of(const NodePtr& t) { return t ? t->lines : 0; }
+    static NodePtr merge(const NodePtr& a, const NodePtr& b);
+    NodePtr split(const NodePtr& t, size_t k, NodePtr& right);
+    static const Node* find(const NodePtr& root, size_t y, size_t& offset);
+    static std::string_view line_of(const NodePtr& root, const Original& original,
+                                    size_t tail_first, size_t y);
+    static std::string_view original_line(const Original& original, size_t n);
+    void set_line(size_t y, std::string text);
+    void insert_lines(size_t y, std::vector<std::string> lines);
+    void erase_lines(size_t y, size_t count);
+    NodePtr build(std::vector<Piece> pieces);
+    void attach_tail();
+
+    template <typename F>
+    static void for_each_piece(const NodePtr& t, F&& f);
+};
+
+template <typename F>
+void TextBuffer::for_each_piece(const NodePtr& t, F&& f) {
+    const Node* n = t.get();
+    while(n) {
+        for_each_piece(n->left, f);
+        f(n->piece);
+        n = n->right.get();
+    }
+}
@@ -9,10 +9,23 @@ enum ColorPairs {
     STRING,
     COMMENT,
     PREPROCESSOR,
-    NUMBER
+    NUMBER,
+    SEARCH
 };
 
 // Editor constants
 const bool SHOW_LINE_NUMBERS_DEFAULT = true;
+const int TAB_WIDTH = 8;
+const size_t UNDO_BUDGET_DEFAULT = size_t(64) << 20;  // bytes of undo history
+const bool SIDECAR_DEFAULT = true;                      // cache index and states of large files
+const size_t SIDECAR_MIN_BYTES = size_t(32) << 20;     // smallest file worth a sidecar
+const size_t FOLLOW_READ_MAX = size_t(16) << 20;       // bytes taken per follow update
+const size_t BUFFER_CAP_DEFAULT = size_t(1) << 30;     // memory of loaded files before eviction
+const size_t PACK_LOOSE_LINES = 65536;                 // edited lines between compressions
+const int JOURNAL_IDLE_MS = 500;                       // pause in typing before the journal syncs
+const size_t JOURNAL_BATCH_BYTES = size_t(1) << 20;    // journal records synced without waiting
+const size_t JOURNAL_COMPACT_BYTES = size_t(16) << 20; // journal growth before compaction
+const size_t COMPLETION_ITEMS = 10;                    // words offered by Ctrl-N / Ctrl-P
+const size_t WORD_RECOUNT_LINES = 4096;                // lines in one edit worth recounting all words
 constexpr const char* DEFAULT_FILENAME = "untitled.txt";
 const std::string APP_NAME = "Tide";
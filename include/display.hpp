@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "buffer.hpp"
+#include "line_window.hpp"
+
+// One character of a line as it appears on screen. Tabs, control bytes
+// and invalid UTF-8 are resolved here so the renderer never decodes.
+struct Glyph {
+    uint32_t byte;   // offset of the character in the line
+    wchar_t ch;      // code point; '\t' spans `width` blank cells
+    uint8_t width;   // columns; 0 for combining marks
+};
+
+// Display layout of a line. Lines made only of printable ASCII are
+// "plain": one byte per column, with no glyph list at all.
+struct LineLayout {
+    bool valid = false;
+    bool plain = false;
+    uint32_t columns = 0;
+    std::vector<Glyph> glyphs;
+};
+
+// Caches the layout of the lines around the viewport, invalidated through
+// the same edit notifications as the HighlightCache.
+class LayoutCache {
+public:
+    void reset() { window.clear(); }
+    void line_changed(size_t y) { lines_changed(y, 1); }
+    void lines_changed(size_t y, size_t count);
+    void lines_inserted(size_t y, size_t count) { window.lines_inserted(y, count); }
+    void lines_removed(size_t y, size_t count) { window.lines_removed(y, count); }
+    void set_window(size_t first, size_t count) { window.set(first, count); }
+
+    const LineLayout& layout(const TextBuffer& buffer, size_t y);
+
+private:
+    LineWindow<LineLayout> window;
+    LineLayout scratch;
+};
+
+// Byte offset of the character after / before the one at x (UTF-8 aware).
+size_t next_char(std::string_view line, size_t x);
+size_t prev_char(std::string_view line, size_t x);
+// Start of the character that contains byte x.
+size_t char_start(std::string_view line, size_t x);
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+// Watches a file that is being appended to, such as a log, through
+// inotify. Only the bytes past what was already read are read, so the
+// cost of each update is proportional to the new data. Truncation and
+// rotation (the path now naming another file) are reported so the caller
+// can load the file again.
+class FileFollower {
+public:
+    enum Change { NONE, APPENDED, RESET };
+
+    FileFollower();
+    ~FileFollower();
+    FileFollower(const FileFollower&) = delete;
+    FileFollower& operator=(const FileFollower&) = delete;
+
+    // Follows `path`, whose first `offset` bytes are loaded already.
+    bool start(const std::string& path, uint64_t offset);
+    void stop();
+    bool active() const { return notify_fd >= 0; }
+    // Readable when there may be news; poll() it along with the terminal.
+    int fd() const { return notify_fd; }
+    // True while appended data is left over from a read that hit the cap.
+    bool behind() const { return active() && lagging; }
+
+    // Takes pending events and reads up to FOLLOW_READ_MAX new bytes.
+    // On APPENDED, `text` is what goes at the end of the last line: it
+    // starts with '\n' if the loaded data ended with one, and a final '\n'
+    // is held back until more text follows it.
+    Change read(std::string& text);
+
+private:
+    std::string path;
+    int notify_fd;
+    int file_fd;
+    ino_t inode;
+    dev_t device;
+    uint64_t offset;
+    bool terminated;  // the data read so far ends with '\n'
+    bool lagging;
+
+    bool rotated() const;
+};
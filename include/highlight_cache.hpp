@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "buffer.hpp"
+#include "line_window.hpp"
+#include "syntax.hpp"
+
+// Highlight results for the lines around the viewport. The syntax state
+// entering every line of the file is tracked by a background worker that
+// highlights a snapshot of the buffer ahead of and behind the viewport and
+// hands each result over through a single atomic pointer exchange.
+//
+// The UI thread never walks the file. Edits are forwarded to the worker as
+// a log; meanwhile edited lines are re-highlighted in place from the entry
+// state already known for them, and the exit state is carried forward
+// within the window. Lines whose entry state is not known yet have no
+// spans, so they are drawn in NORMAL until the worker catches up.
+//
+// The spans of all window lines live in one arena; a rehighlighted line
+// appends its new spans and the arena is compacted once it is mostly stale.
+class HighlightCache {
+public:
+    explicit HighlightCache(SyntaxHighlighter& highlighter);
+    ~HighlightCache();
+
+    // Drops all results and stops the worker, e.g. when a file is loaded.
+    void reset();
+    // Entry states of every line of the file as loaded, e.g. from a
+    // Sidecar, so the worker starts out with nothing left to scan.
+    void seed(std::vector<uint8_t> states) { seeded = std::move(states); }
+    // The worker's entry states for all `lines` lines once it got through
+    // the whole file, as long as the file was not edited.
+    bool file_states(size_t lines, std::vector<uint8_t>& states) const;
+    void line_changed(size_t y) { lines_changed(y, 1); }
+    // Lines [y, y + count) were modified in place.
+    void lines_changed(size_t y, size_t count);
+    void lines_inserted(size_t y, size_t count);
+    void lines_removed(size_t y, size_t count);
+
+    // Keeps highlight results for lines [first, first + count), plus one
+    // window's worth of lines above and below it.
+    void set_window(size_t first, size_t count);
+
+    // Sends the current text to the worker if anything changed since the
+    // last call, and adopts the newest result. Call once per frame.
+    void update(const TextBuffer& buffer);
+    // True while the worker has not answered the last request yet.
+    bool busy() const { return answered != requested; }
+
+    // Highlight spans of line y, valid until the cache is next used.
+    struct Spans {
+        const HighlightSpan* first;
+        const HighlightSpan* last;
+        const HighlightSpan* begin() const { return first; }
+        const HighlightSpan* end() const { return last; }
+    };
+
+    // Entry state of line y, or the default state while it is unknown.
+    SyntaxState state_at(const TextBuffer& buffer, size_t y);
+    // Empty while line y has not been highlighted yet.
+    Spans spans(const TextBuffer& buffer, size_t y);
+    // Whether the spans of line y changed since the last call for it.
+    bool take_repaint(size_t y);
+
+private:
+    struct Edit {
+        enum Kind : uint8_t { CHANGED, INSERTED, REMOVED } kind;
+        size_t y;
+        size_t count;
+        uint64_t version;  // buffer version produced by the edit
+    };
+    struct Request;
+    struct Frame;
+    class Worker;
+
+    struct Slot {
+        bool known = false;    // entry state is known
+        bool valid = false;    // spans are current
+        bool repaint = false;  // spans changed since last drawn
+        uint8_t entry = 0;
+        uint32_t first = 0;    // range of the line's spans in `arena`
+        uint32_t count = 0;
+    };
+
+    SyntaxHighlighter& highlighter;
+    std::unique_ptr<Worker> worker;
+    std::vector<uint8_t> seeded;
+    LineWindow<Slot> window;
+    size_t window_first;
+    size_t window_count;
+    std::vector<HighlightSpan> arena;
+    size_t compact_at;
+
+    uint64_t version;         // bumped by every edit
+    std::vector<Edit> edits;  // edits newer than the last adopted frame
+    size_t unsent;            // edits[unsent..] were not sent yet
+    uint64_t requested;       // id of the last request sent
+    uint64_t answered;        // id of the request of the last adopted frame
+    uint64_t sent_version;
+    size_t sent_lines;
+    size_t sent_first;
+    size_t sent_count;
+
+    static uint8_t pack(const SyntaxState& s);
+    static SyntaxState unpack(uint8_t bits);
+    void record(Edit::Kind kind, size_t y, size_t count);
+    void adopt(const Frame& frame);
+    void rehighlight(const TextBuffer& buffer, size_t y, Slot& s);
+    void compact();
+};
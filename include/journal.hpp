@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "buffer.hpp"
+
+// Crash-recovery log of the edits made to a file, kept next to it as
+// .name.tide-swap. Edits are appended as binary records; sync() hands the
+// batch to a writer thread, which appends and fdatasyncs it, so the editor
+// never waits on the disk and never rewrites the buffer.
+//
+// The records apply to the file as it was loaded, or as last saved. When
+// they outgrow what they describe, compact() replaces them with the
+// buffer itself: runs of lines of that file by reference, and the edited
+// lines as text. `tide -r` replays the journal with recover().
+//
+// The file is created with the first edit and removed by discard(). A
+// journal that is already there, from a crash or another editor, is left
+// alone and this one stays off.
+class Journal {
+public:
+    explicit Journal(const std::string& file);
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    static std::string path_for(const std::string& file);
+    const std::string& path() const { return journal_path; }
+    // Whether edits are being recorded.
+    bool active() const { return !blocked && !failed.load(std::memory_order_relaxed); }
+
+    void insert(size_t y, size_t x, std::string_view text);
+    void erase(size_t y, size_t x, size_t end_y, size_t end_x);
+    void replace(const std::vector<TextBuffer::LineEdit>& edits);
+
+    // Records not yet handed to the writer.
+    bool dirty() const { return !pending.empty(); }
+    void sync();
+    // True once the records written since the last compaction take more
+    // room than the compacted journal would.
+    bool wants_compaction() const;
+    // Rewrites the journal as `text`, the buffer after the last record.
+    void compact(TextBuffer::Snapshot text);
+
+    // A save of `saved` began and finished. Once it is written, records
+    // made in between are kept on top of the saved file, and if there are
+    // none the journal goes.
+    void save_started();
+    void save_finished(bool written, TextBuffer::Snapshot saved);
+
+    // Removes the journal file, if this journal made it.
+    void discard();
+
+    // Replays the journal onto `buffer`, which holds the file as loaded,
+    // and keeps recording after it. Returns the number of edits applied,
+    // or -1 with `error` set.
+    long recover(TextBuffer& buffer, std::string& error);
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t size;  // of the file the records apply to
+        int64_t mtime;  // in nanoseconds
+    };
+
+    // Work for the writer thread, done in order.
+    struct Job {
+        enum Kind { APPEND, COMPACT, MARK, REBASE } kind;
+        std::string records;          // APPEND
+        TextBuffer::Snapshot text;    // COMPACT, REBASE
+        Header header;                // REBASE
+    };
+
+    // Where lines of the loaded file ended up in the saved one.
+    struct Moved {
+        size_t first;  // in the loaded file
+        size_t count;
+        size_t to;     // in the saved file
+    };
+
+    std::string file_path;
+    std::string journal_path;
+    bool blocked;  // found a journal that is not ours
+    std::string pending;
+    uint64_t since_compact;  // record bytes since the last compaction
+    bool saving;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping;
+    std::atomic<bool> failed;
+    std::atomic<bool> compacting;
+    std::atomic<uint64_t> compacted;  // size of the last compacted journal
+
+    // Writer state
+    int fd;
+    Header header;
+    uint64_t mark;  // journal size at the last MARK
+    bool rebased;   // lines of the loaded file move as given by `moved`
+    std::vector<Moved> moved;
+
+    void add(uint8_t type, uint64_t a, uint64_t b, uint64_t c, uint64_t d, std::string_view text);
+    void post(Job job);
+    void work();
+    bool create();
+    bool append(const std::string& records);
+    bool replace_file(const TextBuffer::Snapshot* base, uint64_t tail_from);
+    bool write_base(const TextBuffer::Snapshot& text, int out) const;
+    void stop(bool finish);
+};
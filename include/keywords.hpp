@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+constexpr std::string_view CPP_KEYWORDS[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+    "bool", "break", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
+    "class", "compl", "concept", "const", "consteval", "constexpr", "const_cast",
+    "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete",
+    "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
+    "false", "float", "for", "friend", "goto", "if", "inline", "int", "long",
+    "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator",
+    "or", "or_eq", "private", "protected", "public", "register", "reinterpret_cast",
+    "requires", "return", "short", "signed", "sizeof", "static", "static_assert",
+    "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+    "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+    "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"
+};
+
+// Perfect hash over a keyword list, built at compile time. A word is hashed
+// from its length and four of its bytes with a single multiply, looked up
+// in a 512-slot table and confirmed with one comparison, so matching a
+// std::string_view never allocates.
+class KeywordTable {
+public:
+    template <size_t N>
+    constexpr KeywordTable(const std::string_view (&words)[N], uint32_t multiplier) :
+        slots{}, words(words), multiplier(multiplier), min_length(~size_t(0)),
+        max_length(0), perfect(N < 255) {
+        for(size_t i = 0; i < N && perfect; i++) {
+            uint32_t h = hash(words[i]);
+            if(slots[h]) perfect = false;
+            slots[h] = static_cast<uint8_t>(i + 1);
+            if(words[i].size() < min_length) min_length = words[i].size();
+            if(words[i].size() > max_length) max_length = words[i].size();
+        }
+    }
+
+    constexpr bool contains(std::string_view word) const {
+        if(word.size() < min_length || word.size() > max_length) return false;
+        uint8_t slot = slots[hash(word)];
+        return slot && words[slot - 1] == word;
+    }
+
+    constexpr bool is_perfect() const { return perfect; }
+
+private:
+    static constexpr size_t BITS = 9;
+
+    uint8_t slots[size_t(1) << BITS];
+    const std::string_view* words;
+    uint32_t multiplier;
+    size_t min_length;
+    size_t max_length;
+    bool perfect;
+
+    constexpr uint32_t hash(std::string_view w) const {
+        uint32_t key = uint32_t(uint8_t(w[0])) |
+                       uint32_t(uint8_t(w[w.size() > 1])) << 8 |
+                       uint32_t(uint8_t(w[w.size() / 2])) << 16 |
+                       uint32_t(uint8_t(w[w.size() - 1])) << 24;
+        key ^= static_cast<uint32_t>(w.size()) * 0x9E3779B9u;
+        return (key * multiplier) >> (32 - BITS);
+    }
+};
+
+constexpr KeywordTable CPP_KEYWORD_TABLE(CPP_KEYWORDS, 0x42efa13du);
+static_assert(CPP_KEYWORD_TABLE.is_perfect(), "keyword hash has collisions; pick another multiplier");
+
+constexpr std::string_view PYTHON_KEYWORDS[] = {
+    "False", "None", "True", "and", "as", "assert", "async", "await", "break",
+    "class", "continue", "def", "del", "elif", "else", "except", "finally", "for",
+    "from", "global", "if", "import", "in", "is", "lambda", "nonlocal", "not", "or",
+    "pass", "raise", "return", "try", "while", "with", "yield", "match", "case"
+};
+
+constexpr std::string_view SHELL_KEYWORDS[] = {
+    "if", "then", "else", "elif", "fi", "case", "esac", "for", "select", "while",
+    "until", "do", "done", "in", "function", "time", "return", "exit", "local",
+    "export", "readonly", "declare", "unset", "shift", "break", "continue",
+    "source", "alias", "set", "trap", "eval", "exec"
+};
+
+constexpr std::string_view JSON_KEYWORDS[] = {"true", "false", "null"};
+
+constexpr std::string_view YAML_KEYWORDS[] = {
+    "true", "false", "null", "yes", "no", "on", "off",
+    "True", "False", "Null", "Yes", "No", "On", "Off"
+};
+
+constexpr KeywordTable PYTHON_KEYWORD_TABLE(PYTHON_KEYWORDS, 0xff4780ebu);
+constexpr KeywordTable SHELL_KEYWORD_TABLE(SHELL_KEYWORDS, 0xb8672f8du);
+constexpr KeywordTable JSON_KEYWORD_TABLE(JSON_KEYWORDS, 0x6ac1f425u);
+constexpr KeywordTable YAML_KEYWORD_TABLE(YAML_KEYWORDS, 0x6ac1f425u);
+static_assert(PYTHON_KEYWORD_TABLE.is_perfect() && SHELL_KEYWORD_TABLE.is_perfect() &&
+              JSON_KEYWORD_TABLE.is_perfect() && YAML_KEYWORD_TABLE.is_perfect(),
+              "keyword hash has collisions; pick another multiplier");
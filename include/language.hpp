@@ -0,0 +1,320 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "config.hpp"
+#include "keywords.hpp"
+
+// One kind of string literal.
+struct StringRule {
+    char quote;      // 0 for none
+    char escape;     // makes the next byte part of the string; 0 for none
+    bool multiline;  // runs on past the end of the line, as in shell
+    bool triple;     // three quotes open a multi-line string, as in Python
+    bool word_start; // a quote inside a word is just text, as in YAML
+};
+
+// What a language looks like to the highlighter. Delimiters are one or two
+// bytes of punctuation.
+struct Grammar {
+    const char* name;
+    const KeywordTable* keywords;      // or nullptr
+    std::string_view line_comments[2];
+    std::string_view block_open;
+    std::string_view block_close;
+    char preprocessor;                 // colors the rest of the line; 0 for none
+    bool comment_after_space;          // line comments only start a word, as in shell
+    bool numbers;
+    StringRule strings[2];
+};
+
+// A Grammar compiled into a DFA over byte classes. Each byte of a line
+// takes the color of the state it moves to. Transitions that need more
+// than that are marked EVENT: the color changes, a word starts or ends
+// (and is looked up in `keywords`), or the rest of the line is colored
+// alike. BACK moves the start of the new color one byte back, for the
+// first byte of a two-byte delimiter. `eol` is the state the next line
+// starts in.
+//
+// Lexers are built at compile time; the tables of one fit in a few cache
+// lines.
+struct Lexer {
+    static constexpr size_t MAX_STATES = 64;
+    static constexpr size_t CLASSES = 16;
+    static constexpr size_t SKIP_BYTES = 8;
+
+    // The bytes that keep a state, in a form a SIMD scan can test 16 or 32
+    // at a time: a set of ASCII letters, digits and up to SKIP_BYTES other
+    // bytes. `until` says whether a run goes on until a byte in the set
+    // (the quote that ends a string) or while its bytes are in it (the
+    // letters of a word). States whose set does not fit are scanned byte
+    // by byte.
+    struct Skip {
+        uint8_t bytes[SKIP_BYTES];
+        uint8_t count;
+        bool letters;
+        bool digits;
+        bool until;
+        bool vector;
+    };
+
+    static constexpr uint8_t STATE = 0x3f;
+    static constexpr uint8_t EVENT = 0x40;
+    static constexpr uint8_t BACK = 0x80;
+
+    // State flags
+    static constexpr uint8_t WORD = 1;
+    static constexpr uint8_t REST = 2;
+
+    const char* name;
+    const KeywordTable* keywords;
+    uint8_t byte_class[256];
+    uint8_t next[MAX_STATES][CLASSES];
+    uint8_t color[MAX_STATES];
+    uint8_t flags[MAX_STATES];
+    uint8_t eol[MAX_STATES];
+    uint16_t stay[MAX_STATES];  // bit k: class k leaves the state as it is
+    Skip skip[MAX_STATES];
+    uint8_t states;
+    uint8_t classes;
+    bool fits;  // the grammar needed no more states or classes than there are
+
+    constexpr explicit Lexer(const Grammar& g) :
+        name(g.name), keywords(g.keywords), byte_class{}, next{}, color{}, flags{},
+        eol{}, stay{}, skip{}, states(0), classes(MARKS), fits(true) {
+        for(int c = 0; c < 256; c++) {
+            uint8_t k = OTHER;
+            if(c == ' ' || c == '\t') k = SPACE;
+            else if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') k = LETTER;
+            else if(c >= '0' && c <= '9') k = DIGIT;
+            else if(c == '.') k = DOT;
+            byte_class[c] = k;
+        }
+
+        // State 0 is where a file starts: the start of a line, or after
+        // blanks. Everything that continues normal text gets a copy of its
+        // row, so the first byte after a word or a string is handled alike.
+        const uint8_t normal = add(NORMAL, 0);
+        const uint8_t punct = g.comment_after_space ? add(NORMAL, 0) : normal;
+        const uint8_t word = add(NORMAL, g.keywords ? WORD : 0);
+        const uint8_t number = g.numbers ? add(NUMBER, 0) : punct;
+        for(uint8_t k = 0; k < CLASSES; k++) next[normal][k] = punct;
+        next[normal][SPACE] = normal;
+        next[normal][LETTER] = word;
+        next[normal][DIGIT] = number;
+
+        uint8_t pending[2] = {};  // after the first byte of a two-byte opener
+        char pending_byte[2] = {};
+        uint8_t endings[8] = {};  // states whose row is normal's
+        size_t ending_count = 0;
+        auto opener = [&](std::string_view open, uint8_t target) {
+            if(open.size() == 1) {
+                next[normal][mark(open[0])] = target;
+                return;
+            }
+            size_t p = 0;
+            while(p < 2 && pending[p] && pending_byte[p] != open[0]) p++;
+            if(p == 2) {
+                fits = false;
+                return;
+            }
+            if(!pending[p]) {
+                pending[p] = add(NORMAL, 0);
+                pending_byte[p] = open[0];
+                next[normal][mark(open[0])] = pending[p];
+            }
+            mark(open[1]);
+        };
+
+        uint8_t line_comment = 0;
+        for(std::string_view open : g.line_comments) {
+            if(open.empty()) continue;
+            if(!line_comment) line_comment = add(COMMENT, REST);
+            opener(open, line_comment);
+        }
+        if(g.preprocessor) opener(std::string_view(&g.preprocessor, 1), add(PREPROCESSOR, REST));
+
+        uint8_t block = 0;
+        if(!g.block_open.empty()) {
+            block = add(COMMENT, 0);
+            const uint8_t star = add(COMMENT, 0);
+            const uint8_t end = add(COMMENT, 0);
+            endings[ending_count++] = end;
+            opener(g.block_open, block);
+            const uint8_t first = mark(g.block_close[0]);
+            const uint8_t second = mark(g.block_close[1]);
+            fill(block, block);
+            next[block][first] = star;
+            fill(star, block);
+            next[star][first] = star;
+            next[star][second] = end;
+            eol[block] = eol[star] = block;
+        }
+
+        uint8_t quotes[2] = {};
+        uint8_t empties[2] = {};  // after "", where a third quote opens """
+        uint8_t triples[2] = {};
+        for(size_t r = 0; r < 2; r++) {
+            const StringRule& rule = g.strings[r];
+            if(!rule.quote) continue;
+            const uint8_t quote = mark(rule.quote);
+            const uint8_t escape = rule.escape ? mark(rule.escape) : 0;
+            const uint8_t body = add(STRING, 0);
+            const uint8_t escaped = add(STRING, 0);
+            const uint8_t end = add(STRING, 0);
+            endings[ending_count++] = end;
+            fill(body, body);
+            next[body][quote] = end;
+            if(escape) next[body][escape] = escaped;
+            fill(escaped, body);
+            eol[body] = rule.multiline ? body : normal;
+            eol[escaped] = body;
+            quotes[r] = body;
+            if(rule.triple) {
+                const uint8_t open = add(STRING, 0);
+                const uint8_t empty = add(STRING, 0);
+                const uint8_t triple = add(STRING, 0);
+                const uint8_t one = add(STRING, 0);
+                const uint8_t two = add(STRING, 0);
+                const uint8_t triple_escaped = add(STRING, 0);
+                endings[ending_count++] = empty;
+                fill(open, body);
+                next[open][quote] = empty;
+                if(escape) next[open][escape] = escaped;
+                eol[open] = eol[body];
+                const uint8_t inside[3] = {triple, one, two};
+                for(size_t q = 0; q < 3; q++) {
+                    fill(inside[q], triple);
+                    next[inside[q]][quote] = q < 2 ? inside[q + 1] : end;
+                    if(escape) next[inside[q]][escape] = triple_escaped;
+                    eol[inside[q]] = triple;
+                }
+                fill(triple_escaped, triple);
+                eol[triple_escaped] = triple;
+                quotes[r] = open;
+                empties[r] = empty;
+                triples[r] = triple;
+            }
+            next[normal][quote] = quotes[r];
+        }
+
+        // Normal's row is complete; the rest continue normal text
+        auto like_normal = [&](uint8_t s) {
+            for(uint8_t k = 0; k < CLASSES; k++) next[s][k] = next[normal][k];
+            if(g.comment_after_space) {
+                for(std::string_view open : g.line_comments) {
+                    if(open.size() == 1) next[s][byte_class[uint8_t(open[0])]] = punct;
+                }
+            }
+        };
+        if(punct != normal) like_normal(punct);
+        like_normal(word);
+        next[word][LETTER] = next[word][DIGIT] = word;
+        if(number != punct) {
+            like_normal(number);
+            next[number][LETTER] = next[number][DIGIT] = next[number][DOT] = number;
+        }
+        for(size_t r = 0; r < 2; r++) {
+            if(quotes[r] && g.strings[r].word_start) {
+                next[word][byte_class[uint8_t(g.strings[r].quote)]] = word;
+                if(number != punct) next[number][byte_class[uint8_t(g.strings[r].quote)]] = number;
+            }
+        }
+        for(size_t e = 0; e < ending_count; e++) like_normal(endings[e]);
+        for(size_t r = 0; r < 2; r++) {
+            if(empties[r]) next[empties[r]][byte_class[uint8_t(g.strings[r].quote)]] = triples[r];
+        }
+        for(size_t p = 0; p < 2; p++) {
+            if(!pending[p]) continue;
+            like_normal(pending[p]);
+            for(std::string_view open : g.line_comments) {
+                if(open.size() == 2 && open[0] == pending_byte[p]) {
+                    next[pending[p]][byte_class[uint8_t(open[1])]] = line_comment | BACK;
+                }
+            }
+            if(g.block_open.size() == 2 && g.block_open[0] == pending_byte[p]) {
+                next[pending[p]][byte_class[uint8_t(g.block_open[1])]] = block | BACK;
+            }
+        }
+
+        for(uint8_t s = 0; s < states; s++) {
+            for(uint8_t k = 0; k < CLASSES; k++) {
+                uint8_t t = next[s][k] & STATE;
+                if(next[s][k] == s) stay[s] |= uint16_t(1u << k);
+                if((next[s][k] & BACK) ||
+                   (t != s && (color[t] != color[s] || ((flags[t] ^ flags[s]) & WORD) ||
+                               (flags[t] & REST)))) {
+                    next[s][k] |= EVENT;
+                }
+            }
+            skip[s] = skip_of(s);
+        }
+    }
+
+private:
+    // Byte classes; delimiter bytes get one each from MARKS up
+    static constexpr uint8_t OTHER = 0;
+    static constexpr uint8_t SPACE = 1;
+    static constexpr uint8_t LETTER = 2;
+    static constexpr uint8_t DIGIT = 3;
+    static constexpr uint8_t DOT = 4;
+    static constexpr uint8_t MARKS = 5;
+
+    // A new state that ends lines in state 0
+    constexpr uint8_t add(uint8_t c, uint8_t f) {
+        if(states == MAX_STATES) {
+            fits = false;
+            return 0;
+        }
+        color[states] = c;
+        flags[states] = f;
+        eol[states] = 0;
+        return states++;
+    }
+
+    constexpr uint8_t mark(char c) {
+        uint8_t& k = byte_class[uint8_t(c)];
+        if(k >= MARKS) return k;
+        if(classes == CLASSES) {
+            fits = false;
+            return OTHER;
+        }
+        return k = classes++;
+    }
+
+    // States that stay on OTHER stop at the few bytes that leave them;
+    // the rest stay on the few that keep them.
+    constexpr Skip skip_of(uint8_t s) const {
+        Skip k{};
+        k.until = stay[s] >> OTHER & 1;
+        k.vector = true;
+        auto in = [&](int c) { return (stay[s] >> byte_class[c] & 1) != k.until; };
+        for(int c = 0; c < 256; c++) {
+            bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            bool digit = c >= '0' && c <= '9';
+            if(!in(c)) continue;
+            if(letter) k.letters = true;
+            else if(digit) k.digits = true;
+            else if(k.count < SKIP_BYTES) k.bytes[k.count++] = uint8_t(c);
+            else k.vector = false;
+        }
+        // Letters and digits are tested as ranges, all or none
+        for(int c = 0; c < 256; c++) {
+            bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            bool digit = c >= '0' && c <= '9';
+            if((letter && in(c) != k.letters) || (digit && in(c) != k.digits)) k.vector = false;
+        }
+        return k;
+    }
+
+    constexpr void fill(uint8_t s, uint8_t target) {
+        for(uint8_t k = 0; k < CLASSES; k++) next[s][k] = target;
+    }
+};
+
+// The lexer for a file, by its extension. Files of other kinds are plain
+// text and get no colors.
+const Lexer& lexer_for(const std::string& path);
+// What SyntaxHighlighter starts out with.
+extern const Lexer CPP_LEXER;
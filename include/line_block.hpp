@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Consecutive lines stored LZ-compressed as one immutable block, for edited
+// lines far from the cursor (see TextBuffer::pack). A block costs a few
+// bytes per line where a loose line costs a tree node and a std::string.
+//
+// Blocks are decoded whole, on demand, into a cache of the HOT_BLOCKS most
+// recently used blocks of the calling thread, so the threads reading a
+// snapshot never share state. A view into a block stays valid until its
+// thread has decoded HOT_BLOCKS other blocks; callers that need several
+// blocks at once hold on to decode() instead.
+class LineBlock {
+public:
+    // Raw bytes packed into one block.
+    static constexpr size_t BLOCK_BYTES = size_t(64) << 10;
+    static constexpr size_t HOT_BLOCKS = 8;
+
+    explicit LineBlock(const std::vector<std::string_view>& lines);
+
+    size_t lines() const { return starts.size() - 1; }
+    // Offset of line i in the decoded text, for i <= lines().
+    size_t start(size_t i) const { return starts[i]; }
+    size_t packed_size() const { return packed.size() + starts.size() * sizeof(uint32_t); }
+
+    // The lines, each followed by '\n'.
+    std::shared_ptr<const std::string> decode() const;
+    std::string_view line(size_t i) const {
+        return std::string_view(*decode()).substr(starts[i], starts[i + 1] - starts[i] - 1);
+    }
+
+private:
+    std::string packed;
+    std::vector<uint32_t> starts;
+    uint64_t id;  // cache key; addresses can be reused
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Offsets of line starts in an immutable byte range, built on a background
+// thread. The range is cut into chunks whose newlines are found in
+// parallel on ThreadPool::background() with a SIMD kernel; finished
+// chunks are stitched into the table in order, so lines near the start of
+// the file are published before the rest is scanned. Offsets are stored in
+// fixed-size blocks that never move, so the UI thread can read every
+// published entry without locking while the indexer keeps appending.
+class LineIndex {
+public:
+    LineIndex();
+    ~LineIndex();
+    LineIndex(const LineIndex&) = delete;
+    LineIndex& operator=(const LineIndex&) = delete;
+
+    void build(const char* data, size_t size);
+    // Uses a finished table of lines + 1 offsets, e.g. from a Sidecar,
+    // that must outlive the index.
+    void adopt(const uint64_t* table, size_t lines);
+
+    // Number of lines whose start and end are both known.
+    size_t lines() const;
+    bool done() const { return finished.load(std::memory_order_acquire); }
+    void wait_for(size_t count) const;
+    void wait() const;
+
+    // Start of line i, for i <= lines(). offset(lines()) is the end of the
+    // last line plus one, as if it were terminated by '\n'.
+    uint64_t offset(size_t i) const {
+        if(table) return table[i];
+        return blocks[i >> BLOCK_BITS][i & (BLOCK_SIZE - 1)];
+    }
+
+private:
+    static constexpr size_t BLOCK_BITS = 16;
+    static constexpr size_t BLOCK_SIZE = size_t(1) << BLOCK_BITS;
+    static constexpr size_t CHUNK_BYTES = size_t(4) << 20;
+
+    std::vector<std::unique_ptr<uint64_t[]>> blocks;
+    const uint64_t* table;  // adopted offsets, used instead of blocks
+    std::atomic<size_t> published;
+    std::atomic<bool> finished;
+    std::atomic<bool> stop;
+    size_t pending;
+    std::thread worker;
+    mutable std::mutex mutex;
+    mutable std::condition_variable cv;
+
+    void scan(const char* data, size_t size);
+    void append(const std::vector<uint64_t>& offsets, size_t size);
+    void push(uint64_t offset);
+    void publish(bool last);
+    void reset();
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Per-line slots for the lines [first, first + size) around the viewport.
+// Slots follow their lines as lines are inserted or removed; lines that
+// newly enter the window get default-constructed slots.
+template <typename Slot>
+class LineWindow {
+public:
+    Slot* find(size_t y) {
+        if(y < first || y - first >= slots.size()) return nullptr;
+        return &slots[y - first];
+    }
+
+    // Moves the window to [new_first, new_first + count), keeping the
+    // slots of lines that stay inside it.
+    void set(size_t new_first, size_t count) {
+        if(new_first == first && count == slots.size()) return;
+        std::vector<Slot> moved(count);
+        for(size_t i = 0; i < count; i++) {
+            if(Slot* s = find(new_first + i)) moved[i] = std::move(*s);
+        }
+        slots.swap(moved);
+        first = new_first;
+    }
+
+    void clear() {
+        for(auto& s : slots) s = Slot();
+    }
+
+    void lines_inserted(size_t y, size_t count) {
+        if(y < first) {
+            first += count;
+        } else if(y - first < slots.size()) {
+            size_t at = y - first;
+            size_t n = std::min(count, slots.size() - at);
+            slots.insert(slots.begin() + at, n, Slot());
+            slots.resize(slots.size() - n);
+        }
+    }
+
+    void lines_removed(size_t y, size_t count) {
+        if(y + count <= first) {
+            first -= count;
+        } else if(y < first + slots.size()) {
+            size_t from = y > first ? y - first : 0;
+            size_t to = std::min(y + count - first, slots.size());
+            slots.erase(slots.begin() + from, slots.begin() + to);
+            slots.resize(slots.size() + (to - from));
+            if(y < first) first = y;
+        }
+    }
+
+    // Calls f on the slots of the lines in [y, y + count) that are inside
+    // the window.
+    template <typename F>
+    void for_each_in(size_t y, size_t count, F f) {
+        size_t from = std::max(y, first);
+        size_t to = std::min(y + count, first + slots.size());
+        for(size_t i = from; i < to; i++) f(slots[i - first]);
+    }
+
+    typename std::vector<Slot>::iterator begin() { return slots.begin(); }
+    typename std::vector<Slot>::iterator end() { return slots.end(); }
+
+private:
+    size_t first = 0;
+    std::vector<Slot> slots;
+};
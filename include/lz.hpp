@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Small LZ77 block codec in the style of LZ4: a greedy single-probe hash
+// match finder over a 64 KB window, and a decoder that is a loop of
+// memcpy calls. It trades ratio for speed, which suits text that is
+// decoded every time it scrolls into view.
+//
+// A block is a series of sequences, each a token byte (literal length in
+// the high nibble, match length - 4 in the low one, 15 meaning more
+// length bytes follow), the literals, and a 2-byte offset and extra match
+// length bytes. The last sequence has literals only.
+void lz_compress(std::string_view in, std::string& out);
+// Decodes exactly `size` bytes into out; false if `in` is malformed.
+bool lz_decompress(std::string_view in, char* out, size_t size);
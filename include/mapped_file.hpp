@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a file. Pages are faulted in by the kernel on
+// first access, so opening is O(1) regardless of file size.
+//
+// Reading a page of a mapping past the end of a file that was truncated
+// meanwhile raises SIGBUS. Files that may shrink under the editor, such
+// as followed logs, are read into private memory instead, either from the
+// start or by copy() once it is known.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // With `copy`, the file is read into private memory right away.
+    bool open(const std::string& path, bool copy = false);
+    void close();
+    // Replaces the mapping with a private copy of the same bytes at the
+    // same address, so threads reading it see no change. A file that
+    // shrank before it was read leaves zeros past its new end.
+    bool copy();
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    // Modification time of the file when it was opened, in nanoseconds.
+    int64_t mtime() const { return modified; }
+
+private:
+    const char* ptr;
+    size_t len;
+    int64_t modified;
+    int fd;  // of the mapped file, for copy(); -1 once copied
+
+    static char* read_all(int fd, size_t size);
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Latency histogram with log-linear buckets: exact below 16 ns, then eight
+// buckets per power of two, so any percentile is within 12.5% of the true
+// value. Recording is a couple of bit operations and an increment.
+class Histogram {
+public:
+    void record(uint64_t ns);
+    void reset();
+
+    uint64_t count() const { return total; }
+    uint64_t last() const { return latest; }
+    uint64_t max() const { return largest; }
+    uint64_t mean() const { return total ? sum / total : 0; }
+    // Smallest bucket bound below which a share p (0-1) of samples fall.
+    uint64_t percentile(double p) const;
+    // Prints the non-empty buckets as "upper_bound_ns count" lines.
+    void dump(FILE* f, const char* name) const;
+
+private:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int BUCKETS = 16 + (64 - 4) * (1 << SUB_BITS);
+
+    uint32_t buckets[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t latest = 0;
+    uint64_t largest = 0;
+
+    static int bucket_of(uint64_t ns);
+    static uint64_t upper_bound(int bucket);
+};
+
+// Histograms of the phases of the main loop. Collection is off until an
+// overlay or a log asks for it, and then costs two clock reads per phase.
+class PerfStats {
+public:
+    enum Phase {
+        FRAME,      // a whole loop iteration, input through refresh
+        INPUT,      // key handling
+        SCROLL,     // gutter width and viewport
+        HIGHLIGHT,  // syntax window and worker hand-off
+        DRAW,       // gutter, rows and status bar into curses
+        REFRESH,    // curses output to the terminal
+        PHASES
+    };
+
+    bool enabled = false;
+
+    static const char* name(Phase phase);
+    Histogram& operator[](Phase phase) { return phases[phase]; }
+    const Histogram& operator[](Phase phase) const { return phases[phase]; }
+    void reset();
+    // Summary table followed by the buckets of every phase.
+    void dump(FILE* f) const;
+
+private:
+    Histogram phases[PHASES];
+};
+
+// Records the time until the end of its scope into one phase.
+class PerfTimer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    PerfTimer(PerfStats& stats, PerfStats::Phase phase) :
+        stats(stats.enabled ? &stats : nullptr), phase(phase) {
+        if(this->stats) start = Clock::now();
+    }
+    ~PerfTimer() {
+        if(stats) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+            (*stats)[phase].record(ns.count());
+        }
+    }
+    PerfTimer(const PerfTimer&) = delete;
+    PerfTimer& operator=(const PerfTimer&) = delete;
+
+private:
+    PerfStats* stats;
+    PerfStats::Phase phase;
+    Clock::time_point start;
+};
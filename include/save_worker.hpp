@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include "buffer.hpp"
+
+// Saves buffer snapshots on a background thread, one at a time, so writing
+// a large file never blocks the editor.
+class SaveWorker {
+public:
+    SaveWorker();
+    ~SaveWorker();
+    SaveWorker(const SaveWorker&) = delete;
+    SaveWorker& operator=(const SaveWorker&) = delete;
+
+    // Starts writing `text` to `path`; false if a save is still running.
+    bool start(TextBuffer::Snapshot text, const std::string& path);
+    bool running() const { return active.load(std::memory_order_acquire); }
+    // Share of the file written so far, 0-100.
+    int percent() const;
+    // Returns true once for every save that finished; `error` is the errno
+    // of the step that failed, or 0 on success.
+    bool finished(int& error);
+
+private:
+    std::thread thread;
+    std::atomic<bool> active;
+    TextBuffer::SaveProgress progress;
+};
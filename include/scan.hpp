@@ -0,0 +1,7 @@
+#pragma once
+
+// The widest SIMD instruction set the CPU supports for the byte scans,
+// "avx2", "sse2" or "scalar", checked once at startup. The newline,
+// search and highlighter kernels follow it. TIDE_SCAN=scalar|sse2|avx2
+// forces a specific one.
+const char* scan_isa();
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "buffer.hpp"
+
+// Literal substring matcher. Candidates are found by comparing the first
+// and last byte of the pattern against 32 (AVX2) or 16 (SSE2) positions at
+// once and only those are compared in full; without SIMD, or on the short
+// tail of the text, a Horspool scan is used instead. The kernel follows
+// scan_isa(), so TIDE_SCAN forces it too.
+class SearchPattern {
+public:
+    SearchPattern() = default;
+    explicit SearchPattern(std::string pattern);
+
+    const std::string& text() const { return pattern; }
+    bool empty() const { return pattern.empty(); }
+
+    // First match starting at or after `from`, or npos.
+    size_t find(std::string_view text, size_t from = 0) const;
+    // Last match starting before `before`, or npos.
+    size_t find_last(std::string_view text, size_t before) const;
+
+private:
+    std::string pattern;
+    size_t shift[256];  // Horspool bad-character shifts
+
+    size_t horspool(const char* s, size_t n, size_t from) const;
+};
+
+// Finds the nearest match after (forward) or before (!forward) position
+// (y, x) of the snapshot, wrapping around the end of the buffer, and
+// returns false if there is none. `wrapped` tells whether the search went
+// past the end. Large buffers are split into chunks that are scanned on
+// all cores.
+bool search_buffer(const TextBuffer::Snapshot& text, const SearchPattern& pattern,
+                   size_t y, size_t x, bool forward,
+                   size_t& match_y, size_t& match_x, bool& wrapped);
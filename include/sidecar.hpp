@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "line_index.hpp"
+#include "mapped_file.hpp"
+
+// On-disk cache of the work done when a large file is opened: its line
+// offsets and the syntax state entering every line. Sidecars live in
+// $XDG_CACHE_HOME/tide (or ~/.cache/tide), named after a hash of the
+// file's absolute path, and are only used while the file's size, mtime and
+// a hash of sampled bytes still match.
+//
+// The file is a header, the offset table and the syntax states as runs of
+// lines with one packed state, all 8-byte words. It is mapped rather than
+// read, so the offset table is used in place; opening only makes one pass
+// over it to check that the offsets rise to the end of the file.
+class Sidecar {
+public:
+    // Maps the sidecar of `path` if there is one that matches `file`.
+    bool open(const std::string& path, const MappedFile& file);
+
+    size_t lines() const { return header ? header->lines : 0; }
+    // lines() + 1 offsets, laid out as LineIndex::offset() returns them.
+    const uint64_t* offsets() const;
+    bool has_states() const { return header && header->runs; }
+    // Packed entry state of every line, as HighlightCache keeps them.
+    void states(std::vector<uint8_t>& out) const;
+
+    // Writes the sidecar of `path` for `file`, whose index must be done.
+    // `states` may be empty to store the index alone.
+    static bool write(const std::string& path, const MappedFile& file,
+                      const LineIndex& index, const std::vector<uint8_t>& states);
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t size;    // of the file
+        int64_t mtime;    // of the file, in nanoseconds
+        uint64_t sample;  // hash of bytes sampled from the file
+        uint64_t lines;
+        uint64_t runs;    // state runs after the offsets, 0 without states
+    };
+
+    MappedFile map;
+    const Header* header = nullptr;
+
+    static std::string path_of(const std::string& path);
+    static uint64_t sample(const MappedFile& file);
+};
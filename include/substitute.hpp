@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "buffer.hpp"
+
+// An ex substitute command, :[range]s/pattern/replacement/[g].
+//
+// The range is '%', 'N', 'N,M' (where N and M may also be '.' or '$'),
+// or the cursor line when left out. A pattern without regex
+// metacharacters is matched literally with SearchPattern; anything else
+// goes through std::regex (ECMAScript). In the replacement '&' stands for
+// the match and \1..\9 for groups; \& and \\ are literal.
+struct Substitution {
+    size_t first = 0;  // lines [first, last]
+    size_t last = 0;
+    std::string pattern;
+    std::string replacement;
+    bool global = false;  // every match on a line, not just the first
+
+    // Returns false if cmd is not a substitute command at all; otherwise
+    // `error` is left empty unless the command is malformed.
+    bool parse(const std::string& cmd, size_t cursor_y, size_t line_count, std::string& error);
+};
+
+// Result of running a substitution over a snapshot.
+struct SubstituteResult {
+    std::vector<TextBuffer::LineEdit> lines;  // new text of changed lines, in order
+    size_t count = 0;                         // replacements made
+};
+
+// Matches the lines of the range in chunks spread over the thread pool and
+// collects the rewritten lines, leaving the buffer itself alone so they can
+// be applied in one batch. Returns false if the pattern is not valid.
+bool run_substitution(const TextBuffer::Snapshot& text, const Substitution& s,
+                      SubstituteResult& result, std::string& error);
@@ -1,22 +1,39 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include "language.hpp"
 
+// Where the previous line left the lexer, e.g. inside a block comment.
 struct SyntaxState {
-    bool in_string = false;
-    bool in_char = false;
-    bool in_comment = false;
-    bool escape = false;
+    uint8_t lexer = 0;  // state of the Lexer in use
+
+    bool operator==(const SyntaxState& o) const { return lexer == o.lexer; }
+    bool operator!=(const SyntaxState& o) const { return !(*this == o); }
+};
+
+// A run of characters drawn with one ColorPairs value. Highlighters only
+// emit non-NORMAL runs; anything between spans is NORMAL.
+struct HighlightSpan {
+    uint32_t start;
+    uint32_t length;
+    uint8_t color;
 };
 
 class SyntaxHighlighter {
 public:
-    SyntaxHighlighter();
-    std::vector<int> highlight(const std::string& line, SyntaxState& state);
+    SyntaxHighlighter() = default;
+    explicit SyntaxHighlighter(const Lexer& language) : lexer(&language) {}
+
+    // Appends the spans of `line` to `out`, in order and non-overlapping.
+    // `out` is not cleared, so several lines can share one buffer.
+    void highlight(std::string_view line, SyntaxState& state, std::vector<HighlightSpan>& out);
+
+    // States are only meaningful to the lexer that made them.
+    void set_language(const Lexer& l) { lexer = &l; }
+    const Lexer& language() const { return *lexer; }
 
 private:
-    std::unordered_set<std::string> cpp_keywords;
-    void init_keywords();
-    void handle_strings(char current_char, SyntaxState& state);
+    const Lexer* lexer = &CPP_LEXER;
 };
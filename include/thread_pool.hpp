@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for the parallel scans. run() hands out the
+// numbered tasks of one job through a shared counter, so faster threads
+// take more of them; the calling thread works on the job too and run()
+// returns once every task is done. Jobs are run one at a time.
+class ThreadPool {
+public:
+    // One thread per core, counting the caller.
+    static ThreadPool& shared();
+    // The same, for scans that run behind the editor, such as the line
+    // index of a file being loaded, so they never hold up jobs the user
+    // is waiting on in shared().
+    static ThreadPool& background();
+
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t threads() const { return workers.size() + 1; }
+    // Calls task(i) for every i in [0, tasks), in roughly increasing order.
+    void run(size_t tasks, const std::function<void(size_t)>& task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::mutex serial;  // held for the whole of run()
+    bool stop;
+    uint64_t generation;  // bumped for every job
+    size_t active;        // workers inside the current job
+
+    const std::function<void(size_t)>* task;
+    size_t tasks;
+    std::atomic<size_t> next;
+
+    void loop();
+    void work();
+};
@@ -1,45 +1,221 @@
 #pragma once
 #include <ncurses.h>
+#include <memory>
 #include <vector>
 #include <string>
 #include <fstream>
 #include "config.hpp"
 #include "syntax.hpp"
+#include "buffer.hpp"
+#include "highlight_cache.hpp"
+#include "display.hpp"
+#include "save_worker.hpp"
+#include "undo.hpp"
+#include "search.hpp"
+#include "substitute.hpp"
+#include "perf.hpp"
+#include "follow.hpp"
+#include "journal.hpp"
+#include "word_index.hpp"
 
 class Tide {
 public:
     Tide(const char* filename);
+    // Removes the journals; they only outlive a session that crashed.
+    ~Tide();
     void run();
+    // Collects phase timings and writes them to `path` on exit.
+    void set_perf_log(const std::string& path);
+    // Writes every key batch of the session to `path`, for replay.
+    bool set_record(const std::string& path);
+    // Runs a recorded session on a curses screen with no terminal behind
+    // it and prints the latency of each phase. Returns the exit status.
+    int replay(const std::string& path);
+    // Whether large files are opened from and cached in a Sidecar.
+    void set_sidecar(bool on) { use_sidecar = on; }
+    // Starts in follow mode, see :follow.
+    void set_follow(bool on) { follow_at_start = on; }
+    // Starts by replaying the journal of the first file, see -r.
+    void set_recover(bool on) { recover_at_start = on; }
+    // Adds a file to the buffer list without loading it, see :e.
+    void open_later(const std::string& path);
 
 private:
-    enum Mode { COMMAND, INSERT, EX } mode;
-    std::vector<std::string> buffer;
+    friend class TideBench;  // bench/bench.cpp drives the internals headless
+
+    enum Mode { COMMAND, INSERT, EX, SEARCH } mode;
+    TextBuffer buffer;
     int cursor_x, cursor_y;
     std::string filename;
     bool show_line_numbers;
     bool should_exit;
     SyntaxHighlighter highlighter;
+    HighlightCache syntax_cache;
+    LayoutCache layouts;
     int line_num_width;
     SyntaxState syntax_state;
+    std::string ex_command;
+    SaveWorker saver;
+    bool quit_after_save;
+    std::string message;  // shown in the status bar until the next key
+    UndoLog undo;
+
+    // Search. `highlight` is the pattern whose matches are shown in the
+    // viewport: the one being typed while in SEARCH mode, else the last one.
+    SearchPattern search;
+    SearchPattern highlight;
+    bool search_forward;
+    bool input_forward;  // direction of the search being typed
+    std::string search_input;
+
+    // Instrumentation, see :set perf and --perf-log
+    PerfStats perf;
+    bool perf_overlay;
+    WINDOW* perf_win;
+    std::string perf_log;
+    FILE* record_file;
+
+    // Sidecar cache. `sidecar_pending` is set while the loaded file wants
+    // a sidecar that is missing or lacks syntax states.
+    bool use_sidecar;
+    bool sidecar_pending;
+    void update_sidecar();
+
+    // Follow mode: text appended to the file is added to the buffer as it
+    // is written, see :follow and -f.
+    FileFollower follower;
+    bool follow_at_start;
+    bool set_follow_mode(bool on);
+    bool wait_for_key(int ms);
+    void follow_file();
+
+    // Crash-recovery journal of the current file, null while following it.
+    // `saving_text` is what the running save writes.
+    std::unique_ptr<Journal> journal;
+    TextBuffer::Snapshot saving_text;
+    bool recover_at_start;
+    void sync_journal();
+    void recover_journal();
+
+    // Insert-mode completion with Ctrl-N / Ctrl-P. `words_stale` is set
+    // until `words` starts counting the current buffer. While a completion
+    // is open, completions[0] is the prefix that was typed and the rest
+    // are the words offered for it; completions[completion] is in the text.
+    WordIndex words;
+    bool words_stale;
+    std::vector<std::string> completions;
+    size_t completion;
+    int completion_x;  // where the completed word starts
+    WINDOW* completion_win;
+    void index_words();
+    void recount_words();
+    void complete_word(bool forward);
+    void close_completion();
+    void draw_completion();
+
+    // Edit counts of the current file: `changes` since it was loaded, and
+    // its value when the file was last saved and when the running save
+    // started. The file is modified while changes != saved_changes.
+    size_t changes;
+    size_t saved_changes;
+    size_t saving_changes;
+
+    // Open files, in :bn order. The current one lives in the members above
+    // and its entry only holds its name. Other entries keep their text and
+    // undo history while loaded and are stubs before they are first shown
+    // or after being evicted; either way the cursor is kept.
+    struct OpenFile {
+        std::string filename;
+        int cursor_x = 0, cursor_y = 0, top_line = 0;
+        std::unique_ptr<TextBuffer> text;  // null while not loaded
+        UndoLog undo{UNDO_BUDGET_DEFAULT};
+        std::unique_ptr<Journal> journal;
+        size_t changes = 0;
+        size_t saved_changes = 0;
+        uint64_t used = 0;  // switch_clock when last left
+    };
+    std::vector<OpenFile> files;
+    size_t current_file;
+    uint64_t switch_clock;
+    size_t buffer_cap;
+    void edit_file(const std::string& path);
+    void switch_file(size_t i);
+    void evict_files();
+    void list_files();
+
+    // Viewport and damage tracking. Rows are screen rows above the status
+    // bar; row_states[r] is the syntax state row r was last painted with.
+    int top_line;
+    int prev_cursor_y;
+    int drawn_lines;
+    bool full_redraw;
+    bool gutter_dirty;
+    std::vector<bool> dirty_rows;
+    std::vector<SyntaxState> row_states;
+    std::vector<chtype> row_chars;   // reused by draw_plain
+    std::vector<cchar_t> row_cells;  // reused by draw_glyphs
+    std::vector<HighlightSpan> row_matches;  // search matches in the row
 
     // File operations
     void load_file();
-    void save_file();
+    void reset_views();
+    bool save_file();
+    void check_save();
+    void pack_lines();
 
     // UI components
+    void init_colors();
+    void draw_frame();
+    void set_perf_overlay(bool on);
+    void draw_perf_overlay();
+    void write_perf_log();
     void update_line_number_width();
     void draw_status_bar();
     void draw_line_numbers();
     void draw_buffer();
+    void draw_row(int row);
+    int draw_plain(std::string_view line, HighlightCache::Spans spans, int cursor, int width);
+    int draw_glyphs(std::string_view line, const LineLayout& layout,
+                    HighlightCache::Spans spans, int cursor, int width);
+    int text_rows() const { return LINES - 1; }
+    void scroll_to_cursor();
+    void scroll_rows(int from_row, int delta);
+    void mark_line_dirty(int y);
+    void shift_lines(int y, int delta);
+    void lines_changed(int y, int delta);
     void handle_ex_command(const std::string& cmd);
+    void substitute(Substitution s);
+
+    // Input. Keys are read in batches and the screen is redrawn once per
+    // batch; `keys` is reused between them.
+    std::vector<int> keys;
+    void setup_screen();
+    void handle_keys();
+    void write_keys(FILE* f) const;
+    std::string read_paste(size_t& i);
+    void handle_paste(const std::string& text);
 
     // Mode handlers
     void handle_command_mode(int ch);
     void handle_insert_mode(int ch);
     void handle_ex_mode(std::string& command, int ch);
+    void handle_search_mode(int ch);
+    void set_highlight(const SearchPattern& pattern);
+    void search_next(bool reverse);
 
     // Cursor operations
     void adjust_cursor_x();
     void handle_backspace();
     void handle_newline();
+
+    // Edits. apply_* change the buffer and keep the caches in step; the
+    // *_text variants also record the edit for undo and move the cursor.
+    void apply_insert(size_t y, size_t x, std::string_view text);
+    void apply_erase(size_t y, size_t x, size_t end_y, size_t end_x);
+    void insert_text(size_t y, size_t x, std::string_view text);
+    void erase_text(size_t y, size_t x, size_t end_y, size_t end_x);
+    void apply_lines(std::vector<TextBuffer::LineEdit> edits);
+    void replay_replace(const std::vector<UndoLog::Op>& ops, size_t from, size_t to, bool undoing);
+    void undo_edit();
+    void redo_edit();
 };
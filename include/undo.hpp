@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Undo history as a log of text operations rather than line snapshots.
+// Consecutive operations between two seal() calls form one group that is
+// undone as a unit, and adjacent ones are merged as they are recorded, so
+// a run of typing is a single insert. Undoing a group costs O(size of its
+// text), independent of the size of the buffer.
+//
+// The log is capped by a memory budget; the oldest groups are dropped
+// first, but the newest group is always kept.
+class UndoLog {
+public:
+    // INSERT and ERASE hold the text inserted or erased at (y, x), with
+    // '\n' between lines. REPLACE swaps the whole of line y: `text` is the
+    // old line followed by the new one, and x is the length of the old.
+    struct Op {
+        enum Kind : uint8_t { INSERT, ERASE, REPLACE } kind;
+        size_t y, x;
+        std::string text;
+
+        std::string_view old_line() const { return std::string_view(text).substr(0, x); }
+        std::string_view new_line() const { return std::string_view(text).substr(x); }
+    };
+
+    struct Group {
+        std::vector<Op> ops;
+        size_t before_y, before_x;  // cursor before the first op
+        size_t after_y, after_x;    // cursor after the last op
+        size_t bytes = 0;
+    };
+
+    explicit UndoLog(size_t budget);
+
+    void set_budget(size_t bytes);
+    size_t budget() const { return limit; }
+    size_t memory() const { return used; }
+    void clear();
+
+    // Record an edit that was just applied; the cursor positions are the
+    // ones before and after it.
+    void record_insert(size_t y, size_t x, std::string_view text,
+                       size_t before_y, size_t before_x, size_t after_y, size_t after_x);
+    void record_erase(size_t y, size_t x, std::string text,
+                      size_t before_y, size_t before_x, size_t after_y, size_t after_x);
+    void record_replace(size_t y, std::string_view old_line, std::string_view new_line,
+                        size_t before_y, size_t before_x, size_t after_y, size_t after_x);
+    // Ends the current group; the next edit starts a new one.
+    void seal() { open = false; }
+
+    // Moves the newest group to the redo stack and returns it, or nullptr.
+    // The caller reverts its ops in reverse order. The pointer stays valid
+    // until the log is next modified.
+    const Group* undo();
+    // Moves the newest undone group back and returns it for re-applying.
+    const Group* redo();
+
+    // End of `text` inserted at (y, x).
+    static void end_of(size_t y, size_t x, std::string_view text, size_t& end_y, size_t& end_x);
+
+private:
+    std::deque<Group> done;
+    std::vector<Group> undone;
+    size_t limit;
+    size_t used;
+    bool open;  // the newest group still accepts ops
+
+    Group& current(size_t before_y, size_t before_x);
+    static size_t cost(const Op& op) { return sizeof(Op) + op.text.capacity(); }
+    void charge(Group& g, size_t old_cost, size_t new_cost);
+    void trim();
+};
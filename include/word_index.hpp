@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "buffer.hpp"
+
+// Words of the buffer and how often each occurs, for insert-mode
+// completion. A word is a run of letters, digits and '_' that starts with
+// a letter or '_', as for keywords in the highlighter; one-letter words
+// are left out.
+//
+// The words live in a radix trie whose nodes also hold the largest count
+// below them, so the most frequent words under a prefix are found best
+// first without visiting the rest: a lookup costs the same in any buffer.
+class WordTrie {
+public:
+    WordTrie();
+
+    // Adds `delta` occurrences of `word`, which may be negative.
+    void add(std::string_view word, long delta);
+    // Up to `max` words that extend `prefix`, most frequent first.
+    void complete(std::string_view prefix, size_t max, std::vector<std::string>& out) const;
+    size_t size() const { return words; }
+
+private:
+    struct Node {
+        std::string label;  // bytes on the edge from the parent
+        uint32_t count = 0;
+        uint32_t best = 0;  // largest count in the subtree
+        uint32_t parent = 0;
+        std::vector<uint32_t> children;  // by first byte of their label
+    };
+
+    std::vector<Node> nodes;  // nodes[0] is the root
+    std::vector<uint32_t> free_nodes;
+    size_t words;
+
+    uint32_t make(std::string label, uint32_t parent);
+    size_t child_slot(uint32_t n, char first) const;
+    void update(uint32_t n);
+    std::string word_of(uint32_t n) const;
+};
+
+// The WordTrie of one buffer. rebuild() counts every word of a snapshot
+// on a worker thread; the lines edited meanwhile are counted as they
+// change and folded in when it finishes, after which edits go straight to
+// the trie.
+class WordIndex {
+public:
+    WordIndex();
+    ~WordIndex();
+    WordIndex(const WordIndex&) = delete;
+    WordIndex& operator=(const WordIndex&) = delete;
+
+    // Forgets all words; lines are not counted until the next rebuild().
+    void clear();
+    void rebuild(TextBuffer::Snapshot text);
+    // Takes the result of a finished rebuild. False while lookups would
+    // miss words that are still being counted.
+    bool ready();
+
+    // A line leaves or enters the buffer.
+    void remove_line(std::string_view line) { count_line(line, -1); }
+    void add_line(std::string_view line) { count_line(line, 1); }
+    // Whole lines enter the buffer at once, e.g. from a paste or a followed
+    // file. Their words are tallied first, so each distinct word touches
+    // the trie once and the cost follows the size of the text alone.
+    void add_lines(std::string_view text);
+
+    void complete(std::string_view prefix, size_t max, std::vector<std::string>& out) const {
+        trie.complete(prefix, max, out);
+    }
+
+    // Calls f(word) for each word of `text`.
+    template <typename F>
+    static void for_each_word(std::string_view text, F f);
+
+private:
+    enum State { IDLE, BUILDING, READY } state;
+    WordTrie trie;
+    std::unordered_map<std::string, long> pending;  // counted during a rebuild
+
+    std::thread thread;
+    std::atomic<bool> cancel;
+    std::atomic<bool> finished;
+    std::unique_ptr<WordTrie> built;
+
+    void count_line(std::string_view line, long delta);
+    void build(const TextBuffer::Snapshot& text);
+    void stop();
+};
+
+template <typename F>
+void WordIndex::for_each_word(std::string_view text, F f) {
+    // 1 for bytes that continue a word, 2 for those that can also start one
+    static constexpr struct Table {
+        uint8_t kind[256];
+        constexpr Table() : kind{} {
+            for(int c = 0; c < 256; c++) {
+                if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') kind[c] = 2;
+                else if(c >= '0' && c <= '9') kind[c] = 1;
+            }
+        }
+    } table;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t n = text.size();
+    size_t i = 0;
+    while(i < n) {
+        while(i < n && !table.kind[p[i]]) i++;
+        size_t start = i;
+        while(i < n && table.kind[p[i]]) i++;
+        if(i - start > 1 && table.kind[p[start]] == 2) f(text.substr(start, i - start));
+    }
+}
@@ -0,0 +1,607 @@
+#include "buffer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+TextBuffer::TextBuffer() : tail_first(0), loose(0), seed(2463534242u) {
+    clear();
+}
+
+void TextBuffer::clear() {
+    root = nullptr;
+    tail_first = 0;
+    loose = 0;
+    original = std::make_shared<Original>();
+    original->index.build(nullptr, 0);
+}
+
+TextBuffer::NodePtr TextBuffer::make_node(Piece piece) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return make_node(std::move(piece), seed, nullptr, nullptr);
+}
+
+TextBuffer::NodePtr TextBuffer::make_node(Piece piece, uint32_t priority, NodePtr left, NodePtr right) {
+    size_t lines = lines_of(left) + piece.count + lines_of(right);
+    return std::make_shared<const Node>(Node{std::move(piece), priority, lines,
+                                             std::move(left), std::move(right)});
+}
+
+TextBuffer::NodePtr TextBuffer::merge(const NodePtr& a, const NodePtr& b) {
+    if(!a) return b;
+    if(!b) return a;
+    if(a->priority > b->priority) {
+        return make_node(a->piece, a->priority, a->left, merge(a->right, b));
+    }
+    return make_node(b->piece, b->priority, merge(a, b->left), b->right);
+}
+
+// Splits t so that the returned tree holds the first k lines and `right`
+// the rest. A piece that straddles the boundary is cut in two.
+TextBuffer::NodePtr TextBuffer::split(const NodePtr& t, size_t k, NodePtr& right) {
+    if(!t) {
+        right = nullptr;
+        return nullptr;
+    }
+    size_t left_lines = lines_of(t->left);
+    if(k <= left_lines) {
+        NodePtr inner;
+        NodePtr left = split(t->left, k, inner);
+        right = make_node(t->piece, t->priority, inner, t->right);
+        return left;
+    }
+    if(k >= left_lines + t->piece.count) {
+        NodePtr inner = split(t->right, k - left_lines - t->piece.count, right);
+        return make_node(t->piece, t->priority, t->left, inner);
+    }
+    size_t offset = k - left_lines;
+    NodePtr tail = make_node(t->piece.slice(offset, t->piece.count - offset));
+    right = merge(tail, t->right);
+    return make_node(t->piece.slice(0, offset), t->priority, t->left, nullptr);
+}
+
+const TextBuffer::Node* TextBuffer::find(const NodePtr& root, size_t y, size_t& offset) {
+    const Node* t = root.get();
+    while(t) {
+        size_t left_lines = lines_of(t->left);
+        if(y < left_lines) {
+            t = t->left.get();
+        } else if(y < left_lines + t->piece.count) {
+            offset = y - left_lines;
+            return t;
+        } else {
+            y -= left_lines + t->piece.count;
+            t = t->right.get();
+        }
+    }
+    return nullptr;
+}
+
+std::string_view TextBuffer::original_line(const Original& original, size_t n) {
+    const LineIndex& index = original.index;
+    if(n >= index.lines()) index.wait_for(n + 1);
+    if(n >= index.lines()) return {};
+    size_t start = index.offset(n);
+    size_t end = index.offset(n + 1) - 1;
+    return std::string_view(original.file.data() + start, end - start);
+}
+
+std::string_view TextBuffer::line_of(const NodePtr& root, const Original& original,
+                                     size_t tail_first, size_t y) {
+    size_t tree_lines = lines_of(root);
+    if(y >= tree_lines) return original_line(original, tail_first + (y - tree_lines));
+    size_t offset = 0;
+    const Node* n = find(root, y, offset);
+    if(n->piece.kind == Piece::OWNED) return n->piece.text;
+    if(n->piece.kind == Piece::PACKED) return n->piece.block->line(n->piece.first + offset);
+    return original_line(original, n->piece.first + offset);
+}
+
+size_t TextBuffer::line_count() const {
+    return lines_of(root) + (original->index.lines() - tail_first);
+}
+
+std::string_view TextBuffer::line(size_t y) const {
+    return line_of(root, *original, tail_first, y);
+}
+
+std::string_view TextBuffer::Snapshot::line(size_t y) const {
+    return line_of(root, *original, tail_first, y);
+}
+
+TextBuffer::Snapshot TextBuffer::snapshot() const {
+    Snapshot s;
+    s.root = root;
+    s.original = original;
+    s.tail_first = tail_first;
+    s.tail_end = original->index.lines();
+    return s;
+}
+
+void TextBuffer::Snapshot::runs(std::vector<TextRun>& out) const {
+    const Original& o = *original;
+    size_t y = 0;
+    auto add_original = [&](size_t first, size_t count) {
+        uint64_t start = o.index.offset(first);
+        uint64_t end = std::min<uint64_t>(o.index.offset(first + count), o.file.size());
+        out.push_back({y, count, std::string_view(o.file.data() + start, end - start),
+                       &o.index, first});
+        y += count;
+    };
+    for_each_piece(root, [&](const Piece& p) {
+        if(p.kind == Piece::OWNED) {
+            out.push_back({y, 1, p.text});
+            y++;
+        } else if(p.kind == Piece::PACKED) {
+            // The snapshot keeps the block alive; its text waits for decoded()
+            out.push_back({y, p.count, {}, nullptr, p.first, p.block.get()});
+            y += p.count;
+        } else {
+            add_original(p.first, p.count);
+        }
+    });
+    if(tail_end > tail_first) add_original(tail_first, tail_end - tail_first);
+}
+
+void TextBuffer::Snapshot::original_runs(std::vector<TextRun>& out) const {
+    size_t y = 0;
+    auto add = [&](size_t first, size_t count) {
+        out.push_back({y, count, {}, &original->index, first});
+        y += count;
+    };
+    for_each_piece(root, [&](const Piece& p) {
+        if(p.kind == Piece::ORIGINAL) add(p.first, p.count);
+        else y += p.count;
+    });
+    if(tail_end > tail_first) add(tail_first, tail_end - tail_first);
+}
+
+TextBuffer::TextRun TextBuffer::TextRun::decoded() const {
+    if(!block || keep) return *this;
+    TextRun run = *this;
+    run.keep = block->decode();
+    size_t start = block->start(first);
+    run.text = std::string_view(*run.keep).substr(start, block->start(first + lines) - start);
+    return run;
+}
+
+size_t TextBuffer::TextRun::line_start(size_t i) const {
+    if(block) return block->start(first + i) - block->start(first);
+    if(!index) return i == 0 ? 0 : text.size() + 1;
+    return index->offset(first + i) - index->offset(first);
+}
+
+void TextBuffer::TextRun::position(size_t offset, size_t& line, size_t& column) const {
+    // Last line of the run starting at or before offset
+    size_t lo = 0, hi = lines;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(line_start(mid) <= offset) lo = mid;
+        else hi = mid;
+    }
+    line = y + lo;
+    column = offset - line_start(lo);
+}
+
+void TextBuffer::attach_tail() {
+    size_t known = original->index.lines();
+    if(known == tail_first) return;
+    root = merge(root, make_node({Piece::ORIGINAL, tail_first, known - tail_first, {}}));
+    tail_first = known;
+}
+
+// Replaces line y with an OWNED piece holding `text`.
+void TextBuffer::set_line(size_t y, std::string text) {
+    NodePtr mid;
+    NodePtr left = split(root, y, mid);
+    NodePtr right;
+    split(mid, 1, right);
+    root = merge(merge(left, make_node({Piece::OWNED, 0, 1, std::move(text)})), right);
+    loose++;
+}
+
+void TextBuffer::insert_lines(size_t y, std::vector<std::string> lines) {
+    std::vector<Piece> pieces;
+    pieces.reserve(lines.size());
+    for(auto& l : lines) pieces.push_back({Piece::OWNED, 0, 1, std::move(l)});
+    NodePtr added = build(std::move(pieces));
+    NodePtr right;
+    NodePtr left = split(root, y, right);
+    root = merge(merge(left, added), right);
+    loose += lines.size();
+}
+
+void TextBuffer::erase_lines(size_t y, size_t count) {
+    NodePtr mid, right;
+    NodePtr left = split(root, y, mid);
+    split(mid, count, right);
+    root = merge(left, right);
+}
+
+void TextBuffer::insert(size_t y, size_t x, std::string_view text) {
+    attach_tail();
+    size_t nl = text.find('\n');
+    std::string first(line(y));
+    if(nl == std::string_view::npos) {
+        first.insert(x, text);
+        set_line(y, std::move(first));
+        return;
+    }
+
+    std::vector<std::string> added;
+    std::string tail = first.substr(x);
+    first.erase(x);
+    first.append(text.substr(0, nl));
+    size_t start = nl + 1;
+    while((nl = text.find('\n', start)) != std::string_view::npos) {
+        added.emplace_back(text.substr(start, nl - start));
+        start = nl + 1;
+    }
+    added.emplace_back(text.substr(start));
+    added.back() += tail;
+    set_line(y, std::move(first));
+    insert_lines(y + 1, std::move(added));
+}
+
+void TextBuffer::erase(size_t y, size_t x, size_t end_y, size_t end_x) {
+    attach_tail();
+    std::string first(line(y).substr(0, x));
+    first += line(end_y).substr(end_x);
+    if(end_y > y) erase_lines(y + 1, end_y - y);
+    set_line(y, std::move(first));
+}
+
+// Rebuilds the subtree that spans the edited lines from its pieces, cutting
+// ORIGINAL and PACKED pieces around the edited lines, instead of splitting
+// the whole tree once per line.
+void TextBuffer::replace_lines(std::vector<LineEdit> edits) {
+    if(edits.empty()) return;
+    attach_tail();
+    size_t first = edits.front().y;
+    size_t end = edits.back().y + 1;
+    loose += edits.size();
+    NodePtr rest, right;
+    NodePtr left = split(root, first, rest);
+    NodePtr mid = split(rest, end - first, right);
+
+    std::vector<Piece> pieces;
+    auto append = [&](Piece piece) { pieces.push_back(std::move(piece)); };
+    size_t y = first;
+    size_t e = 0;
+    for_each_piece(mid, [&](const Piece& p) {
+        if(p.kind == Piece::OWNED) {
+            if(e < edits.size() && edits[e].y == y) append({Piece::OWNED, 0, 1, std::move(edits[e++].text)});
+            else append(p);
+            y++;
+            return;
+        }
+        size_t done = 0;  // lines of p already appended
+        while(e < edits.size() && edits[e].y < y + p.count) {
+            size_t at = edits[e].y - y;
+            if(at > done) append(p.slice(done, at - done));
+            append({Piece::OWNED, 0, 1, std::move(edits[e++].text)});
+            done = at + 1;
+        }
+        if(done < p.count) append(p.slice(done, p.count - done));
+        y += p.count;
+    });
+    root = merge(merge(left, build(std::move(pieces))), right);
+}
+
+// Builds a treap over a sequence of pieces in linear time: the shape is
+// found on the right spine with a stack, then nodes are made bottom-up
+// since they are immutable.
+TextBuffer::NodePtr TextBuffer::build(std::vector<Piece> pieces) {
+    size_t n = pieces.size();
+    const size_t none = ~size_t(0);
+    std::vector<uint32_t> priority(n);
+    std::vector<size_t> left(n, none), right(n, none), spine;
+    for(size_t i = 0; i < n; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        priority[i] = seed;
+        size_t last = none;
+        while(!spine.empty() && priority[spine.back()] < priority[i]) {
+            last = spine.back();
+            spine.pop_back();
+        }
+        left[i] = last;
+        if(!spine.empty()) right[spine.back()] = i;
+        spine.push_back(i);
+    }
+    if(spine.empty()) return nullptr;
+
+    auto make = [&](auto& self, size_t i) -> NodePtr {
+        if(i == none) return nullptr;
+        NodePtr l = self(self, left[i]);
+        NodePtr r = self(self, right[i]);
+        return make_node(std::move(pieces[i]), priority[i], std::move(l), std::move(r));
+    };
+    return make(make, spine.front());
+}
+
+void TextBuffer::pack(size_t hot_first, size_t hot_count) {
+    attach_tail();
+    std::vector<Piece> pieces;
+    std::vector<const Piece*> run;  // owned lines waiting to be packed
+    size_t run_bytes = 0;
+    auto flush = [&](bool whole) {
+        // A short run between other pieces is left loose
+        if(whole || run_bytes >= LineBlock::BLOCK_BYTES / 4) {
+            std::vector<std::string_view> lines;
+            lines.reserve(run.size());
+            for(const Piece* p : run) lines.push_back(p->text);
+            auto block = std::make_shared<const LineBlock>(lines);
+            pieces.push_back({Piece::PACKED, 0, lines.size(), {}, std::move(block)});
+        } else {
+            for(const Piece* p : run) pieces.push_back(*p);
+        }
+        run.clear();
+        run_bytes = 0;
+    };
+
+    size_t y = 0;
+    loose = 0;
+    for_each_piece(root, [&](const Piece& p) {
+        bool hot = y + p.count > hot_first && y < hot_first + hot_count;
+        y += p.count;
+        if(p.kind != Piece::OWNED || hot) {
+            if(!run.empty()) flush(false);
+            pieces.push_back(p);
+            return;
+        }
+        run.push_back(&p);
+        run_bytes += p.text.size() + 1;
+        if(run_bytes >= LineBlock::BLOCK_BYTES) flush(true);
+    });
+    if(!run.empty()) flush(false);
+    root = build(std::move(pieces));
+}
+
+bool TextBuffer::restore(const std::vector<Part>& parts) {
+    wait_for_index();
+    std::vector<Piece> pieces;
+    for(const Part& part : parts) {
+        if(part.text.empty()) {
+            if(part.first + part.count > original->index.lines()) return false;
+            pieces.push_back({Piece::ORIGINAL, part.first, part.count, {}});
+            continue;
+        }
+        size_t start = 0;
+        for(size_t i = 0; i < part.count; i++) {
+            size_t end = part.text.find('\n', start);
+            if(end == std::string::npos) return false;
+            pieces.push_back({Piece::OWNED, 0, 1, part.text.substr(start, end - start)});
+            start = end + 1;
+        }
+    }
+    if(pieces.empty()) return false;
+    root = build(std::move(pieces));
+    tail_first = original->index.lines();
+    loose = 0;
+    for(const Part& part : parts) if(!part.text.empty()) loose += part.count;
+    return true;
+}
+
+std::string TextBuffer::text(size_t y, size_t x, size_t end_y, size_t end_x) const {
+    if(y == end_y) return std::string(line(y).substr(x, end_x - x));
+    std::string out(line(y).substr(x));
+    for(size_t i = y + 1; i < end_y; i++) {
+        out += '\n';
+        out += line(i);
+    }
+    out += '\n';
+    out += line(end_y).substr(0, end_x);
+    return out;
+}
+
+bool TextBuffer::load(const std::string& path, bool sidecar, bool copy) {
+    auto next = std::make_shared<Original>();
+    if(!next->file.open(path, copy)) return false;
+    root = nullptr;
+    tail_first = 0;
+    loose = 0;
+    original = next;
+    size_t size = original->file.size();
+    original->final_newline = size == 0 || original->file.data()[size - 1] == '\n';
+    if(sidecar && original->sidecar.open(path, original->file)) {
+        original->index.adopt(original->sidecar.offsets(), original->sidecar.lines());
+    } else {
+        original->index.build(original->file.data(), original->file.size());
+    }
+    return true;
+}
+
+void TextBuffer::swap(TextBuffer& other) {
+    std::swap(root, other.root);
+    std::swap(original, other.original);
+    std::swap(tail_first, other.tail_first);
+    std::swap(loose, other.loose);
+    std::swap(seed, other.seed);
+}
+
+bool TextBuffer::sidecar_states(std::vector<uint8_t>& states) const {
+    if(!original->sidecar.has_states()) return false;
+    original->sidecar.states(states);
+    return true;
+}
+
+bool TextBuffer::write_sidecar(const std::string& path, const std::vector<uint8_t>& states) const {
+    return Sidecar::write(path, original->file, original->index, states);
+}
+
+bool TextBuffer::save(const std::string& path) const {
+    return snapshot().save(path);
+}
+
+// Gathers pieces of the output into iovecs that point straight into the
+// mapping and the owned lines, and writes them with as few writev calls as
+// possible. The first error is kept in `error`.
+class IovecWriter {
+public:
+    IovecWriter(int fd, TextBuffer::SaveProgress* progress) :
+        fd(fd), progress(progress), pending(0), error(0) {}
+
+    void add(const char* data, size_t size) {
+        while(size > 0 && !error) {
+            size_t n = std::min(size, MAX_CHUNK);
+            iov.push_back({const_cast<char*>(data), n});
+            pending += n;
+            data += n;
+            size -= n;
+            if(iov.size() == MAX_IOV || pending >= MAX_CHUNK) flush();
+        }
+    }
+
+    void flush() {
+        size_t at = 0;
+        while(at < iov.size() && !error) {
+            int count = static_cast<int>(std::min(iov.size() - at, MAX_IOV));
+            ssize_t n = writev(fd, &iov[at], count);
+            if(n < 0) {
+                if(errno != EINTR) error = errno;
+                continue;
+            }
+            if(progress) progress->written.fetch_add(n, std::memory_order_relaxed);
+            // Skip what was written, trimming a partially written entry
+            while(n > 0 && at < iov.size()) {
+                size_t len = iov[at].iov_len;
+                if(static_cast<size_t>(n) >= len) {
+                    n -= len;
+                    at++;
+                } else {
+                    iov[at].iov_base = static_cast<char*>(iov[at].iov_base) + n;
+                    iov[at].iov_len -= n;
+                    n = 0;
+                }
+            }
+        }
+        iov.clear();
+        pending = 0;
+    }
+
+    int failed() const { return error; }
+
+private:
+    static constexpr size_t MAX_IOV = 1024;
+    static constexpr size_t MAX_CHUNK = size_t(4) << 20;
+
+    int fd;
+    TextBuffer::SaveProgress* progress;
+    std::vector<iovec> iov;
+    size_t pending;
+    int error;
+};
+
+static std::string directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if(slash == std::string::npos) return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Writes to a temporary file next to the target, syncs it and renames it
+// into place, so the mapping of the original file stays valid and neither
+// a failed write nor a crash can leave a truncated file behind.
+bool TextBuffer::Snapshot::save(const std::string& path, SaveProgress* progress) const {
+    auto fail = [&](int error) {
+        if(progress) progress->error = error;
+        return false;
+    };
+
+    const MappedFile& file = original->file;
+    const LineIndex& index = original->index;
+    index.wait();
+
+    // Original lines past the snapshot's tail were never edited, so the
+    // whole rest of the file is written even if it was indexed later.
+    size_t lines_end = index.lines();
+    auto original_bytes = [&](size_t first, size_t count) -> uint64_t {
+        return index.offset(first + count) - index.offset(first);
+    };
+    if(progress) {
+        uint64_t total = 0;
+        for_each_piece(root, [&](const Piece& p) {
+            if(p.kind == Piece::OWNED) total += p.text.size() + 1;
+            else if(p.kind == Piece::PACKED) total += p.block->start(p.first + p.count) - p.block->start(p.first);
+            else total += original_bytes(p.first, p.count);
+        });
+        if(lines_end > tail_first) total += original_bytes(tail_first, lines_end - tail_first);
+        progress->total.store(total, std::memory_order_relaxed);
+    }
+
+    // A symlink is written through, not replaced by the renamed file
+    std::string target = path;
+    if(char* resolved = realpath(path.c_str(), nullptr)) {
+        target = resolved;
+        free(resolved);
+    }
+    std::string tmp = target + ".tide~";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0) return fail(errno);
+
+    IovecWriter out(fd, progress);
+    static const char newline = '\n';
+    auto write_original = [&](size_t first, size_t count) {
+        size_t start = index.offset(first);
+        size_t end = index.offset(first + count);
+        if(end > file.size()) {
+            out.add(file.data() + start, file.size() - start);
+            out.add(&newline, 1);
+        } else {
+            out.add(file.data() + start, end - start);
+        }
+    };
+    for_each_piece(root, [&](const Piece& p) {
+        if(p.kind == Piece::OWNED) {
+            out.add(p.text.data(), p.text.size());
+            out.add(&newline, 1);
+        } else if(p.kind == Piece::PACKED) {
+            // Written before the decoded block can leave the cache
+            std::shared_ptr<const std::string> text = p.block->decode();
+            size_t start = p.block->start(p.first);
+            out.add(text->data() + start, p.block->start(p.first + p.count) - start);
+            out.flush();
+        } else {
+            write_original(p.first, p.count);
+        }
+    });
+    if(lines_end > tail_first) write_original(tail_first, lines_end - tail_first);
+    out.flush();
+
+    // Every line went out with a '\n'; the last one keeps it only if the
+    // file had one, and a buffer of one empty line is an empty file unless
+    // the file was that newline
+    int error = out.failed();
+    off_t written = lseek(fd, 0, SEEK_CUR);
+    bool empty = written == 1 && file.size() != 1;
+    if(!error && written > 0 && (empty || !original->final_newline) &&
+       ftruncate(fd, written - 1) != 0) error = errno;
+    if(!error && fsync(fd) != 0) error = errno;
+    if(::close(fd) != 0 && !error) error = errno;
+    if(error) {
+        unlink(tmp.c_str());
+        return fail(error);
+    }
+
+    struct stat st;
+    if(stat(target.c_str(), &st) == 0) chmod(tmp.c_str(), st.st_mode & 07777);
+    if(rename(tmp.c_str(), target.c_str()) != 0) {
+        error = errno;
+        unlink(tmp.c_str());
+        return fail(error);
+    }
+    // Make the rename itself durable
+    int dir = ::open(directory_of(target).c_str(), O_RDONLY | O_CLOEXEC);
+    if(dir >= 0) {
+        fsync(dir);
+        ::close(dir);
+    }
+    return true;
+}
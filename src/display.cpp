@@ -0,0 +1,107 @@
+#include "display.hpp"
+#include "config.hpp"
+#include <cwchar>
+
+static const wchar_t REPLACEMENT = 0xFFFD;
+
+static bool is_continuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// Decodes the UTF-8 sequence at line[i], storing its length in `len`.
+// Malformed, overlong and surrogate sequences decode as one REPLACEMENT.
+static wchar_t decode(std::string_view line, size_t i, size_t& len) {
+    unsigned char c = line[i];
+    len = 1;
+    if(c < 0x80) return c;
+
+    size_t need;
+    uint32_t cp, min;
+    if((c & 0xE0) == 0xC0)      { need = 2; cp = c & 0x1F; min = 0x80; }
+    else if((c & 0xF0) == 0xE0) { need = 3; cp = c & 0x0F; min = 0x800; }
+    else if((c & 0xF8) == 0xF0) { need = 4; cp = c & 0x07; min = 0x10000; }
+    else return REPLACEMENT;
+
+    if(i + need > line.size()) return REPLACEMENT;
+    for(size_t k = 1; k < need; k++) {
+        unsigned char b = line[i + k];
+        if(!is_continuation(b)) return REPLACEMENT;
+        cp = cp << 6 | (b & 0x3F);
+    }
+    if(cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return REPLACEMENT;
+    len = need;
+    return static_cast<wchar_t>(cp);
+}
+
+static void build_layout(std::string_view line, LineLayout& out) {
+    out.valid = true;
+    out.glyphs.clear();
+
+    size_t i = 0;
+    while(i < line.size() && line[i] >= 0x20 && line[i] < 0x7F) i++;
+    out.plain = i == line.size();
+    if(out.plain) {
+        out.columns = line.size();
+        return;
+    }
+
+    uint32_t column = 0;
+    for(i = 0; i < line.size();) {
+        size_t len;
+        wchar_t ch = decode(line, i, len);
+        int width;
+        if(ch == '\t') {
+            width = TAB_WIDTH - column % TAB_WIDTH;
+        } else if(ch < 0x20 || ch == 0x7F) {
+            width = 2;  // drawn as ^X
+        } else {
+            width = wcwidth(ch);
+            if(width < 0) {
+                ch = REPLACEMENT;
+                width = 1;
+            }
+        }
+        out.glyphs.push_back({static_cast<uint32_t>(i), ch, static_cast<uint8_t>(width)});
+        column += width;
+        i += len;
+    }
+    out.columns = column;
+}
+
+void LayoutCache::lines_changed(size_t y, size_t count) {
+    window.for_each_in(y, count, [](LineLayout& l) { l.valid = false; });
+}
+
+const LineLayout& LayoutCache::layout(const TextBuffer& buffer, size_t y) {
+    LineLayout* l = window.find(y);
+    if(!l) l = &scratch;
+    else if(l->valid) return *l;
+    build_layout(buffer.line(y), *l);
+    return *l;
+}
+
+size_t next_char(std::string_view line, size_t x) {
+    if(x >= line.size()) return line.size();
+    size_t len;
+    decode(line, x, len);
+    return x + len;
+}
+
+size_t prev_char(std::string_view line, size_t x) {
+    if(x == 0) return 0;
+    size_t start = x - 1;
+    while(start > 0 && x - start < 4 && is_continuation(line[start])) start--;
+    // Only step over the whole sequence if it really decodes to one character
+    size_t len;
+    decode(line, start, len);
+    return start + len == x ? start : x - 1;
+}
+
+size_t char_start(std::string_view line, size_t x) {
+    if(x >= line.size() || !is_continuation(line[x])) return x;
+    size_t start = x;
+    while(start > 0 && x - start < 3 && is_continuation(line[start])) start--;
+    size_t len;
+    decode(line, start, len);
+    return start + len > x ? start : x;
+}
@@ -0,0 +1,91 @@
+#include "follow.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.hpp"
+
+FileFollower::FileFollower() :
+    notify_fd(-1), file_fd(-1), inode(0), device(0), offset(0),
+    terminated(false), lagging(false) {}
+
+FileFollower::~FileFollower() {
+    stop();
+}
+
+bool FileFollower::start(const std::string& file, uint64_t loaded) {
+    stop();
+    file_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(file_fd < 0 || fstat(file_fd, &st) != 0) {
+        stop();
+        return false;
+    }
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // The directory is watched too, to see a rotated file's successor appear
+    size_t slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+    if(notify_fd < 0 ||
+       inotify_add_watch(notify_fd, file.c_str(),
+                         IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) < 0 ||
+       inotify_add_watch(notify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO) < 0) {
+        stop();
+        return false;
+    }
+    path = file;
+    inode = st.st_ino;
+    device = st.st_dev;
+    offset = loaded;
+    char last = 0;
+    terminated = loaded > 0 && pread(file_fd, &last, 1, loaded - 1) == 1 && last == '\n';
+    lagging = uint64_t(st.st_size) > offset;
+    return true;
+}
+
+void FileFollower::stop() {
+    if(notify_fd >= 0) close(notify_fd);
+    if(file_fd >= 0) close(file_fd);
+    notify_fd = file_fd = -1;
+    lagging = false;
+}
+
+bool FileFollower::rotated() const {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_ino != inode || st.st_dev != device);
+}
+
+FileFollower::Change FileFollower::read(std::string& text) {
+    if(!active()) return NONE;
+    // Which events arrived does not matter; the file itself is checked
+    char events[4096];
+    while(::read(notify_fd, events, sizeof(events)) > 0) {}
+
+    struct stat st;
+    if(fstat(file_fd, &st) != 0 || uint64_t(st.st_size) < offset || rotated()) return RESET;
+    uint64_t size = st.st_size;
+    if(size == offset) {
+        lagging = false;
+        return NONE;
+    }
+
+    size_t want = std::min<uint64_t>(size - offset, FOLLOW_READ_MAX);
+    std::string data(want, '\0');
+    size_t got = 0;
+    while(got < want) {
+        ssize_t n = pread(file_fd, &data[got], want - got, offset + got);
+        if(n <= 0) break;
+        got += n;
+    }
+    data.resize(got);
+    offset += got;
+    lagging = offset < size;
+    if(data.empty()) return NONE;
+
+    text.clear();
+    if(terminated) text += '\n';
+    text += data;
+    terminated = text.back() == '\n';
+    if(terminated) text.pop_back();
+    return APPENDED;
+}
@@ -0,0 +1,611 @@
+#include "highlight_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+static const size_t MIN_ARENA = 4096;
+// Lines the worker handles between checks for a newer request
+static const size_t CHUNK_LINES = 4096;
+// Lines per chunk of LineStates
+static const size_t STATE_CHUNK = 4096;
+
+// Packed entry states of the lines of a file, in chunks of about
+// STATE_CHUNK lines. Inserting or removing lines moves the states of one
+// chunk and the starts of the chunks after it, not every state behind the
+// edit, so an edit costs the same near the end of a huge file as near the
+// start.
+class LineStates {
+public:
+    explicit LineStates(const std::vector<uint8_t>& states) : total(0), last(0) {
+        for(size_t y = 0; y < states.size(); y += STATE_CHUNK) {
+            size_t end = std::min(y + STATE_CHUNK, states.size());
+            starts.push_back(y);
+            chunks.emplace_back(states.begin() + y, states.begin() + end);
+        }
+        total = states.size();
+    }
+
+    size_t size() const { return total; }
+    uint8_t get(size_t y) const {
+        size_t c = locate(y);
+        return chunks[c][y - starts[c]];
+    }
+    void set(size_t y, uint8_t state) {
+        size_t c = locate(y);
+        chunks[c][y - starts[c]] = state;
+    }
+
+    void push_back(uint8_t state) {
+        if(chunks.empty() || chunks.back().size() >= STATE_CHUNK) {
+            starts.push_back(total);
+            chunks.emplace_back();
+            chunks.back().reserve(STATE_CHUNK);
+        }
+        chunks.back().push_back(state);
+        total++;
+    }
+
+    // Inserts `count` copies of `state` before line y, for y < size().
+    void insert(size_t y, size_t count, uint8_t state) {
+        size_t c = locate(y);
+        std::vector<uint8_t>& chunk = chunks[c];
+        chunk.insert(chunk.begin() + (y - starts[c]), count, state);
+        if(chunk.size() > 2 * STATE_CHUNK) {
+            // Split a chunk that grew too long, e.g. by a large paste
+            std::vector<std::vector<uint8_t>> parts;
+            for(size_t at = 0; at < chunk.size(); at += STATE_CHUNK) {
+                size_t end = std::min(at + STATE_CHUNK, chunk.size());
+                parts.emplace_back(chunk.begin() + at, chunk.begin() + end);
+            }
+            chunks.erase(chunks.begin() + c);
+            chunks.insert(chunks.begin() + c, std::make_move_iterator(parts.begin()),
+                          std::make_move_iterator(parts.end()));
+        }
+        total += count;
+        restart(c);
+    }
+
+    // Removes lines [y, end), for y < end <= size().
+    void erase(size_t y, size_t end) {
+        const size_t first = locate(y);
+        size_t c = first;
+        size_t at = y - starts[c];
+        for(size_t left = end - y; left > 0; at = 0) {
+            std::vector<uint8_t>& chunk = chunks[c];
+            size_t n = std::min(left, chunk.size() - at);
+            chunk.erase(chunk.begin() + at, chunk.begin() + at + n);
+            left -= n;
+            if(chunk.empty()) chunks.erase(chunks.begin() + c);
+            else c++;
+        }
+        // Keeps chunks from dwindling under repeated deletes
+        if(first + 1 < chunks.size() &&
+           chunks[first].size() + chunks[first + 1].size() <= STATE_CHUNK) {
+            chunks[first].insert(chunks[first].end(), chunks[first + 1].begin(),
+                                 chunks[first + 1].end());
+            chunks.erase(chunks.begin() + first + 1);
+        }
+        total -= end - y;
+        restart(first);
+    }
+
+    std::vector<uint8_t> flatten() const {
+        std::vector<uint8_t> out;
+        out.reserve(total);
+        for(const std::vector<uint8_t>& chunk : chunks) out.insert(out.end(), chunk.begin(), chunk.end());
+        return out;
+    }
+
+private:
+    std::vector<std::vector<uint8_t>> chunks;
+    std::vector<size_t> starts;  // first line of each chunk
+    size_t total;
+    mutable size_t last;  // chunk of the last lookup; lines are mostly read in order
+
+    // The chunk holding line y, for y < size().
+    size_t locate(size_t y) const {
+        if(last < chunks.size() && y >= starts[last] && y - starts[last] < chunks[last].size()) {
+            return last;
+        }
+        if(last + 1 < chunks.size() && y >= starts[last + 1] &&
+           y - starts[last + 1] < chunks[last + 1].size()) {
+            return ++last;
+        }
+        last = std::upper_bound(starts.begin(), starts.end(), y) - starts.begin() - 1;
+        return last;
+    }
+
+    // Recomputes the starts of chunks c and up after their sizes changed.
+    void restart(size_t c) {
+        starts.resize(chunks.size());
+        for(size_t i = c; i < chunks.size(); i++) {
+            starts[i] = i == 0 ? 0 : starts[i - 1] + chunks[i - 1].size();
+        }
+        last = 0;
+    }
+};
+
+// Lines whose exit state may be stale, as disjoint ranges, so that a
+// change to every line of the file is one entry and lines inserted or
+// removed only move the ranges after them.
+class DirtyLines {
+public:
+    bool empty() const { return ranges.empty(); }
+    size_t first() const { return ranges.begin()->first; }
+
+    void add(size_t y, size_t count) {
+        if(count == 0) return;
+        size_t from = y, to = y + count;
+        auto it = ranges.upper_bound(from);
+        if(it != ranges.begin()) {
+            auto before = std::prev(it);
+            if(before->second >= from) {
+                from = before->first;
+                to = std::max(to, before->second);
+                ranges.erase(before);
+            }
+        }
+        while(it != ranges.end() && it->first <= to) {
+            to = std::max(to, it->second);
+            it = ranges.erase(it);
+        }
+        ranges.emplace_hint(it, from, to);
+    }
+
+    void remove(size_t y) {
+        auto it = ranges.upper_bound(y);
+        if(it == ranges.begin()) return;
+        --it;
+        size_t from = it->first, to = it->second;
+        if(to <= y) return;
+        ranges.erase(it);
+        if(from < y) ranges.emplace(from, y);
+        if(y + 1 < to) ranges.emplace(y + 1, to);
+    }
+
+    // Lines from y on moved down by count.
+    void lines_inserted(size_t y, size_t count) {
+        std::vector<std::pair<size_t, size_t>> moved = take_from(y);
+        for(const auto& r : moved) {
+            if(r.first < y) add(r.first, y - r.first);
+            size_t from = std::max(r.first, y);
+            add(from + count, r.second - from);
+        }
+    }
+
+    // Lines [y, y + count) are gone and the ones after them moved up.
+    void lines_removed(size_t y, size_t count) {
+        std::vector<std::pair<size_t, size_t>> moved = take_from(y);
+        for(const auto& r : moved) {
+            if(r.first < y) add(r.first, y - r.first);
+            size_t from = std::max(r.first, y + count);
+            if(r.second > from) add(from - count, r.second - from);
+        }
+    }
+
+private:
+    std::map<size_t, size_t> ranges;  // first line -> end
+
+    // Removes and returns the ranges that reach past line y.
+    std::vector<std::pair<size_t, size_t>> take_from(size_t y) {
+        auto it = ranges.upper_bound(y);
+        if(it != ranges.begin() && std::prev(it)->second > y) --it;
+        std::vector<std::pair<size_t, size_t>> taken(it, ranges.end());
+        ranges.erase(it, ranges.end());
+        return taken;
+    }
+};
+
+struct HighlightCache::Request {
+    uint64_t id;
+    uint64_t version;
+    TextBuffer::Snapshot text;
+    std::vector<Edit> edits;  // since the previous request
+    size_t first;
+    size_t count;
+};
+
+// Result of one request: entry states and spans of lines [first, first + n).
+struct HighlightCache::Frame {
+    uint64_t request;
+    uint64_t version;
+    size_t first;
+    std::vector<uint8_t> entry;
+    std::vector<uint32_t> offsets;  // spans of line i: [offsets[i], offsets[i+1])
+    std::vector<HighlightSpan> spans;
+};
+
+// Owns the entry state of every line of the latest snapshot. Requests come
+// in under a mutex and a newer one interrupts long work on an older one.
+// Finished frames are published with one atomic exchange and picked up by
+// the UI thread with another, so neither side ever waits for the other.
+class HighlightCache::Worker {
+public:
+    Worker(const std::vector<uint8_t>& states, const Lexer& language) :
+        highlighter(language), entry(states), thread(&Worker::run, this) {}
+
+    ~Worker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        interrupted.store(true, std::memory_order_relaxed);
+        cv.notify_one();
+        thread.join();
+        delete published.exchange(nullptr);
+    }
+
+    void post(Request request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(has_request) {
+                // The previous request was never started; keep its edits
+                pending.edits.insert(pending.edits.end(), request.edits.begin(),
+                                     request.edits.end());
+                request.edits.swap(pending.edits);
+            }
+            pending = std::move(request);
+            has_request = true;
+        }
+        interrupted.store(true, std::memory_order_relaxed);
+        cv.notify_one();
+    }
+
+    Frame* take() {
+        return published.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+    bool file_states(size_t lines, std::vector<uint8_t>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(finished.empty() || finished.size() != lines) return false;
+        out = finished;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    bool has_request = false;
+    Request pending;
+    std::atomic<bool> interrupted{false};
+    std::atomic<Frame*> published{nullptr};
+    std::vector<uint8_t> finished;  // entry states of the unedited file
+
+    // Touched only by the worker thread
+    SyntaxHighlighter highlighter;
+    TextBuffer::Snapshot text;
+    LineStates entry;            // packed entry state of each known line
+    DirtyLines dirty;            // lines whose exit state may be stale
+    std::vector<HighlightSpan> scratch;
+    bool complete = true;        // entry covers the snapshot, nothing dirty
+    uint64_t text_version = 0;   // version of the buffer in `text`
+
+    std::thread thread;
+
+    void run() {
+        if(entry.size() == 0) entry.push_back(pack(SyntaxState()));
+        for(;;) {
+            Request request;
+            bool got = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || has_request || !complete; });
+                if(stop) return;
+                if(has_request) {
+                    request = std::move(pending);
+                    has_request = false;
+                    got = true;
+                    interrupted.store(false, std::memory_order_relaxed);
+                }
+            }
+            if(got) {
+                for(const Edit& e : request.edits) apply(e);
+                text = std::move(request.text);
+                text_version = request.version;
+                complete = false;
+                process(request);
+            } else {
+                advance();
+            }
+        }
+    }
+
+    void apply(const Edit& e) {
+        size_t y = e.y, count = e.count;
+        if(e.kind == Edit::CHANGED) {
+            size_t end = std::min(y + count, entry.size());
+            if(y < end) dirty.add(y, end - y);
+        } else if(e.kind == Edit::INSERTED) {
+            if(y >= entry.size()) return;
+            entry.insert(y, count, entry.get(y));
+            dirty.lines_inserted(y, count);
+            dirty.add(y, count);
+        } else {
+            if(y >= entry.size()) return;
+            size_t end = std::min(y + count, entry.size());
+            entry.erase(y, end);
+            dirty.lines_removed(y, count);
+            if(y < entry.size()) dirty.add(y, 1);
+        }
+    }
+
+    // Highlights line y from its entry state and pushes the exit state
+    // forward, marking the next line dirty if its entry state changed.
+    void rehighlight(size_t y) {
+        dirty.remove(y);
+        size_t lines = text.line_count();
+        if(y >= lines) return;
+        SyntaxState state = unpack(entry.get(y));
+        scratch.clear();
+        highlighter.highlight(text.line(y), state, scratch);
+
+        uint8_t exit = pack(state);
+        if(y + 1 < entry.size()) {
+            if(entry.get(y + 1) != exit) {
+                entry.set(y + 1, exit);
+                dirty.add(y + 1, 1);
+            }
+        } else if(y + 1 < lines) {
+            entry.push_back(exit);
+        }
+    }
+
+    // One step towards exact entry states for lines [0, limit]: the first
+    // dirty line, or else the line after the last known one.
+    bool step(size_t limit) {
+        if(!dirty.empty() && dirty.first() < std::min(limit, entry.size())) {
+            rehighlight(dirty.first());
+            return true;
+        }
+        if(entry.size() <= limit && entry.size() < text.line_count()) {
+            rehighlight(entry.size() - 1);
+            return true;
+        }
+        return false;
+    }
+
+    // False if a newer request arrived before the states were settled.
+    bool settle(size_t limit) {
+        for(size_t n = 1; step(limit); n++) {
+            if(n % CHUNK_LINES == 0 && interrupted.load(std::memory_order_relaxed)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void process(const Request& request) {
+        size_t lines = text.line_count();
+        size_t first = std::min(request.first, lines);
+        size_t end = std::min(request.first + request.count, lines);
+        if(!settle(end)) return;
+
+        Frame* frame = new Frame{request.id, request.version, first, {}, {}, {}};
+        for(size_t y = first; y < end; y++) {
+            uint8_t state_bits = entry.get(y);
+            frame->entry.push_back(state_bits);
+            frame->offsets.push_back(frame->spans.size());
+            SyntaxState state = unpack(state_bits);
+            highlighter.highlight(text.line(y), state, frame->spans);
+        }
+        frame->offsets.push_back(frame->spans.size());
+        delete published.exchange(frame, std::memory_order_acq_rel);
+    }
+
+    // Works through the rest of the file while nothing else is asked.
+    void advance() {
+        for(size_t n = 0; n < CHUNK_LINES; n++) {
+            if(!step(~size_t(0))) {
+                complete = true;
+                if(text_version == 0 && entry.size() == text.line_count()) {
+                    std::vector<uint8_t> states = entry.flatten();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.swap(states);
+                }
+                text = TextBuffer::Snapshot();
+                return;
+            }
+        }
+    }
+};
+
+HighlightCache::HighlightCache(SyntaxHighlighter& highlighter) :
+    highlighter(highlighter), window_first(0), window_count(0),
+    compact_at(MIN_ARENA) {
+    reset();
+}
+
+HighlightCache::~HighlightCache() {
+}
+
+uint8_t HighlightCache::pack(const SyntaxState& s) {
+    return s.lexer;
+}
+
+SyntaxState HighlightCache::unpack(uint8_t bits) {
+    SyntaxState s;
+    s.lexer = bits;
+    return s;
+}
+
+void HighlightCache::reset() {
+    worker.reset();
+    seeded.clear();
+    window.clear();
+    arena.clear();
+    compact_at = MIN_ARENA;
+    edits.clear();
+    unsent = 0;
+    version = requested = answered = 0;
+    sent_version = 0;
+    sent_lines = sent_first = sent_count = 0;
+}
+
+bool HighlightCache::file_states(size_t lines, std::vector<uint8_t>& states) const {
+    return worker && version == 0 && worker->file_states(lines, states);
+}
+
+void HighlightCache::record(Edit::Kind kind, size_t y, size_t count) {
+    edits.push_back({kind, y, count, ++version});
+}
+
+void HighlightCache::lines_changed(size_t y, size_t count) {
+    record(Edit::CHANGED, y, count);
+    window.for_each_in(y, count, [](Slot& s) { s.valid = false; });
+}
+
+void HighlightCache::lines_inserted(size_t y, size_t count) {
+    record(Edit::INSERTED, y, count);
+    window.lines_inserted(y, count);
+}
+
+void HighlightCache::lines_removed(size_t y, size_t count) {
+    record(Edit::REMOVED, y, count);
+    window.lines_removed(y, count);
+}
+
+void HighlightCache::set_window(size_t first, size_t count) {
+    window_first = first > count ? first - count : 0;
+    window_count = first + 2 * count - window_first;
+    window.set(window_first, window_count);
+}
+
+void HighlightCache::update(const TextBuffer& buffer) {
+    if(!worker) {
+        worker.reset(new Worker(seeded, highlighter.language()));
+        seeded.clear();
+    }
+
+    size_t lines = buffer.line_count();
+    if(version != sent_version || lines != sent_lines ||
+       window_first != sent_first || window_count != sent_count) {
+        std::vector<Edit> fresh(edits.begin() + unsent, edits.end());
+        worker->post({++requested, version, buffer.snapshot(), std::move(fresh),
+                      window_first, window_count});
+        unsent = edits.size();
+        sent_version = version;
+        sent_lines = lines;
+        sent_first = window_first;
+        sent_count = window_count;
+    }
+
+    if(Frame* frame = worker->take()) {
+        adopt(*frame);
+        delete frame;
+    }
+}
+
+// Moves the lines of a frame through the edits made after its snapshot and
+// takes over the results of every line that was not edited since.
+void HighlightCache::adopt(const Frame& frame) {
+    answered = frame.request;
+    size_t done = 0;
+    while(done < edits.size() && edits[done].version <= frame.version) done++;
+    edits.erase(edits.begin(), edits.begin() + done);
+    unsent -= done;
+
+    for(size_t i = 0; i + 1 < frame.offsets.size(); i++) {
+        size_t y = frame.first + i;
+        bool edited = false, removed = false;
+        for(const Edit& e : edits) {
+            if(e.kind == Edit::CHANGED) {
+                if(y >= e.y && y - e.y < e.count) edited = true;
+            } else if(e.kind == Edit::INSERTED) {
+                if(y >= e.y) y += e.count;
+            } else if(y >= e.y + e.count) {
+                y -= e.count;
+            } else if(y >= e.y) {
+                removed = true;
+                break;
+            }
+        }
+        Slot* s = removed ? nullptr : window.find(y);
+        if(!s) continue;
+
+        uint8_t state = frame.entry[i];
+        if(edited) {
+            if(!s->known) s->entry = state;
+            s->known = true;
+            continue;
+        }
+
+        const HighlightSpan* from = frame.spans.data() + frame.offsets[i];
+        uint32_t count = frame.offsets[i + 1] - frame.offsets[i];
+        auto same = [](const HighlightSpan& a, const HighlightSpan& b) {
+            return a.start == b.start && a.length == b.length && a.color == b.color;
+        };
+        if(s->valid && s->entry == state && s->count == count &&
+           std::equal(from, from + count, arena.begin() + s->first, same)) {
+            continue;
+        }
+        if(arena.size() >= compact_at) compact();
+        s->first = arena.size();
+        s->count = count;
+        arena.insert(arena.end(), from, from + count);
+        s->entry = state;
+        s->known = s->valid = s->repaint = true;
+    }
+}
+
+// Highlights line y from the entry state known for it and carries the exit
+// state into the next line of the window.
+void HighlightCache::rehighlight(const TextBuffer& buffer, size_t y, Slot& s) {
+    if(arena.size() >= compact_at) compact();
+    SyntaxState state = unpack(s.entry);
+    s.first = arena.size();
+    highlighter.highlight(buffer.line(y), state, arena);
+    s.count = arena.size() - s.first;
+    s.valid = s.repaint = true;
+
+    uint8_t exit = pack(state);
+    Slot* next = window.find(y + 1);
+    if(next && y + 1 < buffer.line_count() && (!next->known || next->entry != exit)) {
+        next->known = true;
+        next->entry = exit;
+        next->valid = false;
+    }
+}
+
+// Drops the spans of replaced or invalidated lines from the arena.
+void HighlightCache::compact() {
+    std::vector<HighlightSpan> live;
+    live.reserve(arena.size() / 2);
+    for(Slot& s : window) {
+        if(!s.valid) continue;
+        uint32_t first = live.size();
+        live.insert(live.end(), arena.begin() + s.first, arena.begin() + s.first + s.count);
+        s.first = first;
+    }
+    arena.swap(live);
+    compact_at = std::max(MIN_ARENA, arena.size() * 2);
+}
+
+SyntaxState HighlightCache::state_at(const TextBuffer& buffer, size_t y) {
+    Slot* s = window.find(y);
+    if(!s) return SyntaxState();
+    if(y == 0 && !s->known) {
+        s->known = true;
+        s->entry = pack(SyntaxState());
+    }
+    if(!s->known) return SyntaxState();
+    if(!s->valid) rehighlight(buffer, y, *s);
+    return unpack(s->entry);
+}
+
+HighlightCache::Spans HighlightCache::spans(const TextBuffer& buffer, size_t y) {
+    state_at(buffer, y);
+    Slot* s = window.find(y);
+    if(!s || !s->valid) return {nullptr, nullptr};
+    return {arena.data() + s->first, arena.data() + s->first + s->count};
+}
+
+bool HighlightCache::take_repaint(size_t y) {
+    Slot* s = window.find(y);
+    if(!s || !s->repaint) return false;
+    s->repaint = false;
+    return true;
+}
@@ -0,0 +1,432 @@
+#include "journal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.hpp"
+#include "mapped_file.hpp"
+
+static const char MAGIC[8] = {'T', 'I', 'D', 'E', 'J', 'R', 'N', '1'};
+
+// A record is this head, `bytes` of text and a checksum of both. LINES
+// heads a batch of `a` LINE records that is applied whole or not at all;
+// FILE, TEXT and END records make up a compacted journal, which holds the
+// whole buffer.
+enum RecordType : uint8_t { INSERT = 1, ERASE, LINES, LINE, FILE_LINES, TEXT_LINES, END };
+
+struct RecordHead {
+    uint8_t type;
+    uint8_t unused[7];
+    uint64_t a, b, c, d;
+    uint64_t bytes;
+};
+
+static uint32_t checksum(const char* data, size_t size, uint32_t h = 2166136261u) {
+    for(size_t i = 0; i < size; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void put_record(std::string& out, uint8_t type, uint64_t a, uint64_t b,
+                       uint64_t c, uint64_t d, std::string_view text) {
+    RecordHead head{type, {}, a, b, c, d, text.size()};
+    size_t start = out.size();
+    out.append(reinterpret_cast<const char*>(&head), sizeof(head));
+    out.append(text);
+    uint32_t check = checksum(out.data() + start, out.size() - start);
+    out.append(reinterpret_cast<const char*>(&check), sizeof(check));
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) {
+        // A new file: the records apply to an empty buffer
+        size = 0;
+        mtime = 0;
+        return errno == ENOENT;
+    }
+    size = st.st_size;
+    mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string Journal::path_for(const std::string& file) {
+    size_t slash = file.rfind('/');
+    size_t name = slash == std::string::npos ? 0 : slash + 1;
+    return file.substr(0, name) + "." + file.substr(name) + ".tide-swap";
+}
+
+Journal::Journal(const std::string& file) :
+    file_path(file), journal_path(path_for(file)), since_compact(0), saving(false),
+    stopping(false), failed(false), compacting(false), compacted(sizeof(Header)),
+    fd(-1), mark(0), rebased(false) {
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    blocked = access(journal_path.c_str(), F_OK) == 0 ||
+              !stat_file(file_path, header.size, header.mtime);
+}
+
+Journal::~Journal() {
+    sync();
+    stop(true);
+    if(fd >= 0) ::close(fd);
+}
+
+void Journal::add(uint8_t type, uint64_t a, uint64_t b, uint64_t c, uint64_t d,
+                  std::string_view text) {
+    if(!active()) return;
+    size_t before = pending.size();
+    put_record(pending, type, a, b, c, d, text);
+    since_compact += pending.size() - before;
+    if(pending.size() >= JOURNAL_BATCH_BYTES) sync();
+}
+
+void Journal::insert(size_t y, size_t x, std::string_view text) {
+    add(INSERT, y, x, 0, 0, text);
+}
+
+void Journal::erase(size_t y, size_t x, size_t end_y, size_t end_x) {
+    add(ERASE, y, x, end_y, end_x, {});
+}
+
+void Journal::replace(const std::vector<TextBuffer::LineEdit>& edits) {
+    add(LINES, edits.size(), 0, 0, 0, {});
+    for(const TextBuffer::LineEdit& e : edits) add(LINE, e.y, 0, 0, 0, e.text);
+}
+
+void Journal::sync() {
+    if(pending.empty()) return;
+    if(!active()) {
+        pending.clear();
+        return;
+    }
+    Job job{Job::APPEND, std::move(pending), {}, {}};
+    pending.clear();
+    post(std::move(job));
+}
+
+bool Journal::wants_compaction() const {
+    return active() && !saving && !compacting.load(std::memory_order_relaxed) &&
+           since_compact > std::max<uint64_t>(JOURNAL_COMPACT_BYTES,
+                                              compacted.load(std::memory_order_relaxed));
+}
+
+void Journal::compact(TextBuffer::Snapshot text) {
+    sync();
+    compacting.store(true, std::memory_order_relaxed);
+    since_compact = 0;
+    post({Job::COMPACT, {}, std::move(text), {}});
+}
+
+void Journal::save_started() {
+    if(!active()) return;
+    sync();
+    saving = true;
+    post({Job::MARK, {}, {}, {}});
+}
+
+void Journal::save_finished(bool written, TextBuffer::Snapshot saved) {
+    saving = false;
+    Header next;
+    memcpy(next.magic, MAGIC, sizeof(MAGIC));
+    if(!written || !active() || !stat_file(file_path, next.size, next.mtime)) return;
+    sync();
+    post({Job::REBASE, {}, std::move(saved), next});
+}
+
+void Journal::discard() {
+    pending.clear();
+    stop(false);
+    if(fd >= 0) {
+        ::close(fd);
+        fd = -1;
+        unlink(journal_path.c_str());
+    }
+}
+
+void Journal::post(Job job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+    if(!thread.joinable()) thread = std::thread([this] { work(); });
+    wake.notify_one();
+}
+
+// Waits for the writer to finish the queued jobs, or only the current one.
+void Journal::stop(bool finish) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!finish) jobs.clear();
+        stopping = true;
+        wake.notify_one();
+    }
+    if(thread.joinable()) thread.join();
+    stopping = false;
+}
+
+void Journal::work() {
+    for(;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || !jobs.empty(); });
+            if(jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        if(failed.load(std::memory_order_relaxed)) continue;
+        bool ok = true;
+        switch(job.kind) {
+            case Job::APPEND:
+                ok = (fd >= 0 || create()) && append(job.records);
+                break;
+            case Job::COMPACT:
+                ok = replace_file(&job.text, 0);
+                compacted.store(fd >= 0 ? lseek(fd, 0, SEEK_END) : 0, std::memory_order_relaxed);
+                compacting.store(false, std::memory_order_relaxed);
+                break;
+            case Job::MARK:
+                // A journal made during the save starts with the header
+                mark = fd >= 0 ? lseek(fd, 0, SEEK_END) : sizeof(Header);
+                break;
+            case Job::REBASE: {
+                header = job.header;
+                rebased = true;
+                moved.clear();
+                std::vector<TextBuffer::TextRun> runs;
+                job.text.original_runs(runs);
+                for(const TextBuffer::TextRun& run : runs) moved.push_back({run.first, run.lines, run.y});
+                if(fd < 0) break;
+                uint64_t end = lseek(fd, 0, SEEK_END);
+                if(end > mark) {
+                    ok = replace_file(nullptr, mark);
+                } else {
+                    // Nothing was edited during the save
+                    ::close(fd);
+                    fd = -1;
+                    unlink(journal_path.c_str());
+                }
+                compacted.store(sizeof(Header), std::memory_order_relaxed);
+                break;
+            }
+        }
+        if(!ok) failed.store(true, std::memory_order_relaxed);
+    }
+}
+
+bool Journal::create() {
+    fd = ::open(journal_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600);
+    if(fd < 0) return false;
+    return write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+bool Journal::append(const std::string& records) {
+    return write_all(fd, records.data(), records.size()) && fdatasync(fd) == 0;
+}
+
+// Writes the header, then `base` or the journal from byte `tail_from` on,
+// to a new file that then takes the journal's place.
+bool Journal::replace_file(const TextBuffer::Snapshot* base, uint64_t tail_from) {
+    std::string tmp = journal_path + "~";
+    int out = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(out < 0) return false;
+    bool ok = write_all(out, reinterpret_cast<const char*>(&header), sizeof(header));
+    if(ok && base) {
+        ok = write_base(*base, out);
+    } else if(ok && fd >= 0) {
+        char chunk[1 << 16];
+        ssize_t n;
+        for(off_t at = tail_from; ok && (n = pread(fd, chunk, sizeof(chunk), at)) != 0; at += n) {
+            ok = n > 0 && write_all(out, chunk, n);
+        }
+    }
+    ok = ok && fdatasync(out) == 0 && rename(tmp.c_str(), journal_path.c_str()) == 0;
+    if(!ok) {
+        ::close(out);
+        unlink(tmp.c_str());
+        return false;
+    }
+    if(fd >= 0) ::close(fd);
+    fd = out;
+    return true;
+}
+
+// The buffer as records: runs of lines that are in the file by reference,
+// everything else as text.
+bool Journal::write_base(const TextBuffer::Snapshot& text, int out) const {
+    std::vector<TextBuffer::TextRun> runs;
+    text.runs(runs);
+    std::string records;
+    bool ok = true;
+    auto flush = [&](size_t at_least) {
+        if(records.size() < at_least) return;
+        ok = ok && write_all(out, records.data(), records.size());
+        records.clear();
+    };
+    auto add_text = [&](const TextBuffer::TextRun& run, size_t from, size_t count) {
+        size_t start = run.line_start(from);
+        size_t end = std::min(run.line_start(from + count), run.text.size());
+        std::string_view part = run.text.substr(start, end - start);
+        if(part.empty() || part.back() != '\n') {
+            put_record(records, TEXT_LINES, count, 0, 0, 0, std::string(part) + '\n');
+        } else {
+            put_record(records, TEXT_LINES, count, 0, 0, 0, part);
+        }
+    };
+    size_t lines = 0;
+    for(const TextBuffer::TextRun& stored : runs) {
+        // Packed runs are decoded one block at a time
+        TextBuffer::TextRun run = stored.decoded();
+        lines += run.lines;
+        if(!run.index) {
+            add_text(run, 0, run.lines);
+        } else if(!rebased) {
+            put_record(records, FILE_LINES, run.first, run.lines, 0, 0, {});
+        } else {
+            // Lines of the loaded file, found in the saved one where they can be
+            size_t done = 0;
+            auto it = std::upper_bound(moved.begin(), moved.end(), run.first,
+                                       [](size_t first, const Moved& m) { return first < m.first; });
+            if(it != moved.begin()) --it;
+            for(; done < run.lines && it != moved.end(); ++it) {
+                size_t line = run.first + done;
+                if(it->first + it->count <= line) continue;
+                if(it->first > line) {
+                    size_t gap = std::min(it->first - line, run.lines - done);
+                    add_text(run, done, gap);
+                    done += gap;
+                    line += gap;
+                    if(done == run.lines) break;
+                }
+                size_t count = std::min(it->first + it->count - line, run.lines - done);
+                put_record(records, FILE_LINES, it->to + (line - it->first), count, 0, 0, {});
+                done += count;
+            }
+            if(done < run.lines) add_text(run, done, run.lines - done);
+        }
+        flush(JOURNAL_BATCH_BYTES);
+    }
+    put_record(records, END, lines, 0, 0, 0, {});
+    flush(0);
+    return ok;
+}
+
+long Journal::recover(TextBuffer& buffer, std::string& error) {
+    MappedFile journal;
+    if(!journal.open(journal_path)) {
+        error = "no journal " + journal_path;
+        return -1;
+    }
+    Header found;
+    uint64_t size;
+    int64_t mtime;
+    stat_file(file_path, size, mtime);
+    if(journal.size() < sizeof(Header) ||
+       (memcpy(&found, journal.data(), sizeof(found)), memcmp(found.magic, MAGIC, sizeof(MAGIC)))) {
+        error = journal_path + " is not a journal";
+        return -1;
+    }
+    if(found.size != size || found.mtime != mtime) {
+        error = file_path + " changed since " + journal_path + " was written";
+        return -1;
+    }
+    buffer.wait_for_index();
+
+    // Reads records up to the first one that is torn or does not apply
+    const char* data = journal.data();
+    size_t at = sizeof(Header), good = at;
+    long applied = 0;
+    std::vector<TextBuffer::Part> parts;
+    std::vector<TextBuffer::LineEdit> batch;
+    size_t lines_left = 0;  // LINE records still due in the batch
+    auto position_ok = [&](uint64_t y, uint64_t x) {
+        return y < buffer.line_count() && x <= buffer.line_length(y);
+    };
+    for(;;) {
+        RecordHead head;
+        if(journal.size() - at < sizeof(head)) break;
+        memcpy(&head, data + at, sizeof(head));
+        size_t left = journal.size() - at - sizeof(head);
+        if(head.bytes > left || left - head.bytes < sizeof(uint32_t)) break;
+        size_t body = sizeof(head) + head.bytes;
+        uint32_t check;
+        memcpy(&check, data + at + body, sizeof(check));
+        if(check != checksum(data + at, body)) break;
+        std::string_view text(data + at + sizeof(head), head.bytes);
+        at += body + sizeof(check);
+
+        bool idle = lines_left == 0 && parts.empty();
+        bool ok = false, complete = false;
+        switch(head.type) {
+            case INSERT:
+                ok = idle && position_ok(head.a, head.b);
+                if(ok) buffer.insert(head.a, head.b, text);
+                complete = ok;
+                break;
+            case ERASE:
+                ok = idle && position_ok(head.a, head.b) && position_ok(head.c, head.d) &&
+                     (head.a < head.c || (head.a == head.c && head.b <= head.d));
+                if(ok) buffer.erase(head.a, head.b, head.c, head.d);
+                complete = ok;
+                break;
+            case LINES:
+                ok = idle && head.a > 0;
+                lines_left = head.a;
+                break;
+            case LINE:
+                ok = lines_left > 0 && head.a < buffer.line_count() &&
+                     (batch.empty() || head.a > batch.back().y);
+                if(!ok) break;
+                batch.push_back({head.a, std::string(text)});
+                if(--lines_left == 0) {
+                    buffer.replace_lines(std::move(batch));
+                    batch.clear();
+                    complete = true;
+                }
+                break;
+            case FILE_LINES:
+            case TEXT_LINES:
+                ok = lines_left == 0;
+                if(head.type == FILE_LINES) parts.push_back({head.a, head.b, {}});
+                else parts.push_back({0, head.a, std::string(text)});
+                break;
+            case END:
+                ok = complete = lines_left == 0 && buffer.restore(parts);
+                parts.clear();
+                break;
+        }
+        if(!ok) break;
+        if(complete) {
+            applied++;
+            good = at;
+        }
+    }
+
+    // Later edits go after the last record that applied
+    fd = ::open(journal_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if(fd < 0 || ftruncate(fd, good) != 0) {
+        error = "cannot write " + journal_path + ": " + strerror(errno);
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    header = found;
+    blocked = false;
+    compacted.store(good, std::memory_order_relaxed);
+    return applied;
+}
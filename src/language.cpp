@@ -0,0 +1,68 @@
+#include "language.hpp"
+#include <algorithm>
+#include <cctype>
+
+static constexpr Grammar CPP_GRAMMAR = {
+    "C++", &CPP_KEYWORD_TABLE, {"//", ""}, "/*", "*/", '#', false, true,
+    {{'"', '\\', false, false, false}, {'\'', '\\', false, false, false}}
+};
+
+static constexpr Grammar PYTHON_GRAMMAR = {
+    "Python", &PYTHON_KEYWORD_TABLE, {"#", ""}, "", "", 0, false, true,
+    {{'"', '\\', false, true, false}, {'\'', '\\', false, true, false}}
+};
+
+static constexpr Grammar SHELL_GRAMMAR = {
+    "shell", &SHELL_KEYWORD_TABLE, {"#", ""}, "", "", 0, true, true,
+    {{'"', '\\', true, false, false}, {'\'', 0, true, false, false}}
+};
+
+static constexpr Grammar JSON_GRAMMAR = {
+    "JSON", &JSON_KEYWORD_TABLE, {"", ""}, "", "", 0, false, true,
+    {{'"', '\\', false, false, false}, {}}
+};
+
+static constexpr Grammar YAML_GRAMMAR = {
+    "YAML", &YAML_KEYWORD_TABLE, {"#", ""}, "", "", 0, true, true,
+    {{'"', '\\', false, false, true}, {'\'', 0, false, false, true}}
+};
+
+static constexpr Grammar PLAIN_GRAMMAR = {
+    "text", nullptr, {"", ""}, "", "", 0, false, false, {{}, {}}
+};
+
+constexpr Lexer CPP_LEXER(CPP_GRAMMAR);
+static constexpr Lexer PYTHON_LEXER(PYTHON_GRAMMAR);
+static constexpr Lexer SHELL_LEXER(SHELL_GRAMMAR);
+static constexpr Lexer JSON_LEXER(JSON_GRAMMAR);
+static constexpr Lexer YAML_LEXER(YAML_GRAMMAR);
+static constexpr Lexer PLAIN_LEXER(PLAIN_GRAMMAR);
+static_assert(CPP_LEXER.fits && PYTHON_LEXER.fits && SHELL_LEXER.fits &&
+              JSON_LEXER.fits && YAML_LEXER.fits, "grammar too large for a Lexer");
+
+static const struct {
+    const char* extension;
+    const Lexer* lexer;
+} EXTENSIONS[] = {
+    {"c", &CPP_LEXER}, {"h", &CPP_LEXER}, {"cc", &CPP_LEXER}, {"cpp", &CPP_LEXER},
+    {"cxx", &CPP_LEXER}, {"c++", &CPP_LEXER}, {"hh", &CPP_LEXER}, {"hpp", &CPP_LEXER},
+    {"hxx", &CPP_LEXER}, {"inl", &CPP_LEXER}, {"ipp", &CPP_LEXER}, {"tpp", &CPP_LEXER},
+    {"py", &PYTHON_LEXER}, {"pyi", &PYTHON_LEXER}, {"pyw", &PYTHON_LEXER},
+    {"sh", &SHELL_LEXER}, {"bash", &SHELL_LEXER}, {"zsh", &SHELL_LEXER},
+    {"ksh", &SHELL_LEXER}, {"bashrc", &SHELL_LEXER}, {"profile", &SHELL_LEXER},
+    {"json", &JSON_LEXER},
+    {"yml", &YAML_LEXER}, {"yaml", &YAML_LEXER},
+};
+
+const Lexer& lexer_for(const std::string& path) {
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) return PLAIN_LEXER;
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    for(const auto& e : EXTENSIONS) {
+        if(extension == e.extension) return *e.lexer;
+    }
+    return PLAIN_LEXER;
+}
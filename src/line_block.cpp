@@ -0,0 +1,50 @@
+#include "line_block.hpp"
+#include <atomic>
+#include <cstdlib>
+#include "lz.hpp"
+
+static std::atomic<uint64_t> next_id(1);
+
+LineBlock::LineBlock(const std::vector<std::string_view>& lines) :
+    id(next_id.fetch_add(1, std::memory_order_relaxed)) {
+    std::string raw;
+    starts.reserve(lines.size() + 1);
+    for(std::string_view line : lines) {
+        starts.push_back(raw.size());
+        raw += line;
+        raw += '\n';
+    }
+    starts.push_back(raw.size());
+    lz_compress(raw, packed);
+    packed.shrink_to_fit();
+}
+
+// Most recently used decoded blocks of one thread.
+struct HotBlocks {
+    struct Slot {
+        uint64_t id = 0;
+        uint64_t used = 0;
+        std::shared_ptr<const std::string> text;
+    };
+    Slot slots[LineBlock::HOT_BLOCKS];
+    uint64_t clock = 0;
+};
+
+std::shared_ptr<const std::string> LineBlock::decode() const {
+    thread_local HotBlocks hot;
+    HotBlocks::Slot* victim = &hot.slots[0];
+    for(HotBlocks::Slot& slot : hot.slots) {
+        if(slot.id == id) {
+            slot.used = ++hot.clock;
+            return slot.text;
+        }
+        if(slot.used < victim->used) victim = &slot;
+    }
+    auto text = std::make_shared<std::string>(starts.back(), '\0');
+    // Blocks are only ever made by the constructor above
+    if(!lz_decompress(packed, &(*text)[0], text->size())) abort();
+    victim->id = id;
+    victim->used = ++hot.clock;
+    victim->text = text;
+    return text;
+}
@@ -0,0 +1,187 @@
+#include "line_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include "scan.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIDE_INDEX_X86 1
+#endif
+
+// A kernel appends base + i + 1 for every '\n' at s[i] in whole W-byte
+// blocks of s[0, n) and returns where a scalar scan has to take over.
+typedef size_t (*NewlineKernel)(const char* s, size_t n, uint64_t base, std::vector<uint64_t>& out);
+
+#ifdef TIDE_INDEX_X86
+
+__attribute__((target("sse2")))
+static size_t newlines_sse2(const char* s, size_t n, uint64_t base, std::vector<uint64_t>& out) {
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while(mask) {
+            out.push_back(base + i + __builtin_ctz(mask) + 1);
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t newlines_avx2(const char* s, size_t n, uint64_t base, std::vector<uint64_t>& out) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        while(mask) {
+            out.push_back(base + i + __builtin_ctz(mask) + 1);
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+#endif
+
+static NewlineKernel newline_kernel() {
+    // Follows scan_isa(), so TIDE_SCAN applies here too
+    static const NewlineKernel kernel = [] () -> NewlineKernel {
+#ifdef TIDE_INDEX_X86
+        if(!strcmp(scan_isa(), "avx2")) return newlines_avx2;
+        if(!strcmp(scan_isa(), "sse2")) return newlines_sse2;
+#endif
+        return nullptr;
+    }();
+    return kernel;
+}
+
+// Offsets just past every newline in s[0, n), plus base.
+static void find_newlines(const char* s, size_t n, uint64_t base, std::vector<uint64_t>& out) {
+    size_t i = 0;
+    if(NewlineKernel kernel = newline_kernel()) i = kernel(s, n, base, out);
+    while(i < n) {
+        const char* nl = static_cast<const char*>(memchr(s + i, '\n', n - i));
+        if(!nl) break;
+        i = nl - s + 1;
+        out.push_back(base + i);
+    }
+}
+
+LineIndex::LineIndex() : table(nullptr), published(0), finished(false), stop(false), pending(0) {}
+
+LineIndex::~LineIndex() {
+    reset();
+}
+
+void LineIndex::reset() {
+    stop = true;
+    if(worker.joinable()) worker.join();
+    blocks.clear();
+    table = nullptr;
+    published = 0;
+    pending = 0;
+    finished = false;
+    stop = false;
+}
+
+void LineIndex::build(const char* data, size_t size) {
+    reset();
+    // A file of n bytes has at most n + 1 lines, plus the end sentinel.
+    blocks.resize((size + 2) / BLOCK_SIZE + 1);
+    push(0);
+    if(size == 0) {
+        push(1);
+        publish(true);
+        return;
+    }
+    worker = std::thread(&LineIndex::scan, this, data, size);
+}
+
+void LineIndex::adopt(const uint64_t* offsets, size_t lines) {
+    reset();
+    table = offsets;
+    published.store(lines + 1, std::memory_order_release);
+    finished.store(true, std::memory_order_release);
+}
+
+size_t LineIndex::lines() const {
+    size_t n = published.load(std::memory_order_acquire);
+    return n ? n - 1 : 0;
+}
+
+void LineIndex::wait_for(size_t count) const {
+    if(lines() >= count || done()) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return lines() >= count || done(); });
+}
+
+void LineIndex::wait() const {
+    if(done()) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return done(); });
+}
+
+void LineIndex::push(uint64_t offset) {
+    size_t i = published.load(std::memory_order_relaxed) + pending;
+    auto& block = blocks[i >> BLOCK_BITS];
+    if(!block) block.reset(new uint64_t[BLOCK_SIZE]);
+    block[i & (BLOCK_SIZE - 1)] = offset;
+    pending++;
+}
+
+void LineIndex::publish(bool last) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        published.store(published.load(std::memory_order_relaxed) + pending,
+                        std::memory_order_release);
+        pending = 0;
+        if(last) finished.store(true, std::memory_order_release);
+    }
+    cv.notify_all();
+}
+
+// Adds the line starts of one chunk. A trailing newline terminates the
+// last line instead of starting one.
+void LineIndex::append(const std::vector<uint64_t>& offsets, size_t size) {
+    for(uint64_t offset : offsets) {
+        if(offset < size) push(offset);
+    }
+    publish(false);
+}
+
+void LineIndex::scan(const char* data, size_t size) {
+    size_t count = (size + CHUNK_BYTES - 1) / CHUNK_BYTES;
+    std::vector<std::vector<uint64_t>> chunks(count);
+    std::vector<bool> scanned(count);
+    size_t stitched = 0;
+    std::mutex stitch;
+
+    ThreadPool::background().run(count, [&](size_t c) {
+        if(stop.load(std::memory_order_relaxed)) return;
+        size_t begin = c * CHUNK_BYTES;
+        size_t end = std::min(begin + CHUNK_BYTES, size);
+        std::vector<uint64_t> offsets;
+        offsets.reserve((end - begin) / 32);
+        find_newlines(data + begin, end - begin, begin, offsets);
+
+        // Whoever finishes the chunk next in line appends it and any
+        // finished chunks queued up behind it
+        std::lock_guard<std::mutex> lock(stitch);
+        chunks[c].swap(offsets);
+        scanned[c] = true;
+        for(; stitched < count && scanned[stitched]; stitched++) {
+            append(chunks[stitched], size);
+            std::vector<uint64_t>().swap(chunks[stitched]);
+        }
+    });
+
+    if(stitched == count) {
+        bool terminated = data[size - 1] == '\n';
+        push(size + (terminated ? 0 : 1));
+    }
+    publish(true);
+}
@@ -0,0 +1,107 @@
+#include "lz.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 13;
+
+static uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Length bytes past the 15 that fit in a nibble.
+static void put_length(std::string& out, size_t n) {
+    for(; n >= 255; n -= 255) out += char(255);
+    out += char(n);
+}
+
+static bool get_length(std::string_view in, size_t& at, size_t& n) {
+    for(;;) {
+        if(at >= in.size()) return false;
+        uint8_t b = in[at++];
+        n += b;
+        if(b != 255) return true;
+    }
+}
+
+static void put_literals(std::string& out, const char* s, size_t count, uint8_t match_nibble) {
+    out += char((count < 15 ? count : 15) << 4 | match_nibble);
+    if(count >= 15) put_length(out, count - 15);
+    out.append(s, count);
+}
+
+void lz_compress(std::string_view in, std::string& out) {
+    out.clear();
+    out.reserve(in.size() / 2 + 16);
+    const char* s = in.data();
+    size_t n = in.size();
+    thread_local std::vector<uint32_t> table;
+    table.assign(size_t(1) << HASH_BITS, UINT32_MAX);
+
+    size_t anchor = 0;
+    size_t misses = 0;
+    for(size_t i = 0; i + MIN_MATCH <= n; ) {
+        uint32_t v = read32(s + i);
+        uint32_t& slot = table[hash4(v)];
+        size_t candidate = slot;
+        slot = i;
+        if(candidate == UINT32_MAX || i - candidate > MAX_OFFSET || read32(s + candidate) != v) {
+            // Step faster through data that does not compress
+            i += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        size_t length = MIN_MATCH;
+        while(i + length < n && s[candidate + length] == s[i + length]) length++;
+
+        size_t extra = length - MIN_MATCH;
+        put_literals(out, s + anchor, i - anchor, extra < 15 ? extra : 15);
+        size_t offset = i - candidate;
+        out += char(offset & 255);
+        out += char(offset >> 8);
+        if(extra >= 15) put_length(out, extra - 15);
+        i += length;
+        anchor = i;
+    }
+    put_literals(out, s + anchor, n - anchor, 0);
+}
+
+bool lz_decompress(std::string_view in, char* out, size_t size) {
+    size_t at = 0, done = 0;
+    while(at < in.size()) {
+        uint8_t token = in[at++];
+        size_t literals = token >> 4;
+        if(literals == 15 && !get_length(in, at, literals)) return false;
+        if(literals > in.size() - at || literals > size - done) return false;
+        memcpy(out + done, in.data() + at, literals);
+        at += literals;
+        done += literals;
+        if(at == in.size()) break;
+
+        if(in.size() - at < 2) return false;
+        size_t offset = uint8_t(in[at]) | size_t(uint8_t(in[at + 1])) << 8;
+        at += 2;
+        size_t length = token & 15;
+        if(length == 15 && !get_length(in, at, length)) return false;
+        length += MIN_MATCH;
+        if(offset == 0 || offset > done || length > size - done) return false;
+        char* to = out + done;
+        const char* from = to - offset;
+        if(offset >= length) {
+            memcpy(to, from, length);
+        } else {
+            // Overlapping match: repeats the last `offset` bytes
+            for(size_t k = 0; k < length; k++) to[k] = from[k];
+        }
+        done += length;
+    }
+    return done == size;
+}
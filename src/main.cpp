@@ -2,7 +2,31 @@
 #include "config.hpp"
 
 int main(int argc, char** argv) {
-    std::string filename = argc > 1 ? argv[1] : DEFAULT_FILENAME;
-    Tide editor(filename.c_str());
+    std::vector<std::string> files;
+    std::string perf_log, record, replay;
+    bool sidecar = SIDECAR_DEFAULT, follow = false, recover = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--perf-log" && i + 1 < argc) perf_log = argv[++i];
+        else if (arg == "--record" && i + 1 < argc) record = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc) replay = argv[++i];
+        else if (arg == "--no-cache") sidecar = false;
+        else if (arg == "-f") follow = true;
+        else if (arg == "-r") recover = true;
+        else files.push_back(arg);
+    }
+    // Files after the first are loaded when first shown, see :bn
+    Tide editor(files.empty() ? DEFAULT_FILENAME : files[0].c_str());
+    for (size_t i = 1; i < files.size(); i++) editor.open_later(files[i]);
+    if (!perf_log.empty()) editor.set_perf_log(perf_log);
+    editor.set_sidecar(sidecar);
+    editor.set_follow(follow);
+    editor.set_recover(recover);
+    if (!replay.empty()) return editor.replay(replay);
+    if (!record.empty() && !editor.set_record(record)) {
+        fprintf(stderr, "tide: cannot write %s\n", record.c_str());
+        return 1;
+    }
+    editor.run();
     return 0;
 }
@@ -0,0 +1,83 @@
+#include "mapped_file.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : ptr(nullptr), len(0), modified(0), fd(-1) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path, bool copy) {
+    close();
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file < 0) return false;
+
+    struct stat st;
+    if(fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(file);
+        return false;
+    }
+    modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if(st.st_size == 0) {
+        ::close(file);
+        return true;
+    }
+    if(copy) {
+        ptr = read_all(file, st.st_size);
+        ::close(file);
+        if(!ptr) return false;
+        len = st.st_size;
+        return true;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(p == MAP_FAILED) {
+        ::close(file);
+        return false;
+    }
+    ptr = static_cast<const char*>(p);
+    len = st.st_size;
+    fd = file;
+    return true;
+}
+
+bool MappedFile::copy() {
+    if(fd < 0) return true;
+    char* copied = read_all(fd, len);
+    if(!copied) return false;
+    // Moving the copy over the mapping swaps the pages in one step
+    void* p = mremap(copied, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, const_cast<char*>(ptr));
+    if(p == MAP_FAILED) {
+        munmap(copied, len);
+        return false;
+    }
+    ::close(fd);
+    fd = -1;
+    return true;
+}
+
+// Reads `size` bytes of the file into fresh anonymous pages with pread,
+// which reports a short file instead of faulting on it.
+char* MappedFile::read_all(int file, size_t size) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return nullptr;
+    char* data = static_cast<char*>(p);
+    for(size_t got = 0; got < size; ) {
+        ssize_t n = pread(file, data + got, size - got, got);
+        if(n <= 0) break;
+        got += n;
+    }
+    mprotect(p, size, PROT_READ);
+    return data;
+}
+
+void MappedFile::close() {
+    if(ptr) munmap(const_cast<char*>(ptr), len);
+    if(fd >= 0) ::close(fd);
+    ptr = nullptr;
+    len = 0;
+    modified = 0;
+    fd = -1;
+}
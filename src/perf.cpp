@@ -0,0 +1,74 @@
+#include "perf.hpp"
+
+int Histogram::bucket_of(uint64_t ns) {
+    if(ns < 16) return static_cast<int>(ns);
+    int k = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>((ns >> (k - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+    return 16 + ((k - 4) << SUB_BITS) + sub;
+}
+
+uint64_t Histogram::upper_bound(int bucket) {
+    if(bucket < 16) return bucket + 1;
+    int k = ((bucket - 16) >> SUB_BITS) + 4;
+    uint64_t sub = (bucket - 16) & ((1 << SUB_BITS) - 1);
+    uint64_t step = uint64_t(1) << (k - SUB_BITS);
+    return (uint64_t(1) << k) + (sub + 1) * step;
+}
+
+void Histogram::record(uint64_t ns) {
+    buckets[bucket_of(ns)]++;
+    total++;
+    sum += ns;
+    latest = ns;
+    if(ns > largest) largest = ns;
+}
+
+void Histogram::reset() {
+    *this = Histogram();
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if(total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * total);
+    if(rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for(int b = 0; b < BUCKETS; b++) {
+        seen += buckets[b];
+        if(seen > rank) return upper_bound(b) < largest ? upper_bound(b) : largest;
+    }
+    return largest;
+}
+
+void Histogram::dump(FILE* f, const char* name) const {
+    for(int b = 0; b < BUCKETS; b++) {
+        if(buckets[b]) {
+            fprintf(f, "%s %llu %u\n", name, static_cast<unsigned long long>(upper_bound(b)),
+                    buckets[b]);
+        }
+    }
+}
+
+const char* PerfStats::name(Phase phase) {
+    static const char* const names[PHASES] = {
+        "frame", "input", "scroll", "highlight", "draw", "refresh"
+    };
+    return names[phase];
+}
+
+void PerfStats::reset() {
+    for(Histogram& h : phases) h.reset();
+}
+
+void PerfStats::dump(FILE* f) const {
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    fprintf(f, "# phase      count    mean_us     p50_us     p90_us     p99_us     max_us\n");
+    for(int p = 0; p < PHASES; p++) {
+        const Histogram& h = phases[p];
+        fprintf(f, "# %-9s %7llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                name(static_cast<Phase>(p)), static_cast<unsigned long long>(h.count()),
+                us(h.mean()), us(h.percentile(0.5)), us(h.percentile(0.9)),
+                us(h.percentile(0.99)), us(h.max()));
+    }
+    fprintf(f, "# buckets: phase upper_bound_ns count\n");
+    for(int p = 0; p < PHASES; p++) phases[p].dump(f, name(static_cast<Phase>(p)));
+}
@@ -0,0 +1,36 @@
+#include "save_worker.hpp"
+
+SaveWorker::SaveWorker() : active(false) {
+}
+
+SaveWorker::~SaveWorker() {
+    if(thread.joinable()) thread.join();
+}
+
+bool SaveWorker::start(TextBuffer::Snapshot text, const std::string& path) {
+    if(running()) return false;
+    if(thread.joinable()) thread.join();
+
+    progress.written.store(0, std::memory_order_relaxed);
+    progress.total.store(0, std::memory_order_relaxed);
+    progress.error = 0;
+    active.store(true, std::memory_order_release);
+    thread = std::thread([this, text = std::move(text), path] {
+        text.save(path, &progress);
+        active.store(false, std::memory_order_release);
+    });
+    return true;
+}
+
+int SaveWorker::percent() const {
+    uint64_t total = progress.total.load(std::memory_order_relaxed);
+    if(total == 0) return 0;
+    return static_cast<int>(progress.written.load(std::memory_order_relaxed) * 100 / total);
+}
+
+bool SaveWorker::finished(int& error) {
+    if(running() || !thread.joinable()) return false;
+    thread.join();
+    error = progress.error;
+    return true;
+}
@@ -0,0 +1,22 @@
+#include "scan.hpp"
+#include <cstdlib>
+#include <cstring>
+
+static const char* select_isa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    bool has_sse2 = __builtin_cpu_supports("sse2");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    const char* forced = getenv("TIDE_SCAN");
+    if(forced && !strcmp(forced, "scalar")) return "scalar";
+    if(forced && !strcmp(forced, "sse2") && has_sse2) return "sse2";
+    if(has_avx2) return "avx2";
+    if(has_sse2) return "sse2";
+#endif
+    return "scalar";
+}
+
+const char* scan_isa() {
+    static const char* const isa = select_isa();
+    return isa;
+}
@@ -0,0 +1,272 @@
+#include "search.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+#include "scan.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIDE_SEARCH_X86 1
+#endif
+
+static constexpr size_t npos = std::string_view::npos;
+
+// A kernel tests the candidate starts at, at + W, ... while the loads of a
+// whole W-byte window stay inside s[0, n), returns the first full match or
+// npos, and leaves `at` where a scalar scan has to take over.
+typedef size_t (*FindKernel)(const char* s, size_t n, const char* p, size_t m, size_t& at);
+
+#ifdef TIDE_SEARCH_X86
+
+__attribute__((target("sse2")))
+static size_t find_sse2(const char* s, size_t n, const char* p, size_t m, size_t& at) {
+    __m128i first = _mm_set1_epi8(p[0]);
+    __m128i last = _mm_set1_epi8(p[m - 1]);
+    size_t i = at;
+    for(; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+        while(mask) {
+            size_t k = i + __builtin_ctz(mask);
+            if(m <= 2 || !memcmp(s + k + 1, p + 1, m - 2)) return k;
+            mask &= mask - 1;
+        }
+    }
+    at = i;
+    return npos;
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const char* s, size_t n, const char* p, size_t m, size_t& at) {
+    __m256i first = _mm256_set1_epi8(p[0]);
+    __m256i last = _mm256_set1_epi8(p[m - 1]);
+    size_t i = at;
+    for(; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + m - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                              _mm256_cmpeq_epi8(b, last)));
+        while(mask) {
+            size_t k = i + __builtin_ctz(mask);
+            if(m <= 2 || !memcmp(s + k + 1, p + 1, m - 2)) return k;
+            mask &= mask - 1;
+        }
+    }
+    at = i;
+    return npos;
+}
+
+#endif
+
+static FindKernel find_kernel() {
+    // Chosen on first use, by scan_isa()
+    static const FindKernel kernel = [] () -> FindKernel {
+#ifdef TIDE_SEARCH_X86
+        if(!strcmp(scan_isa(), "avx2")) return find_avx2;
+        if(!strcmp(scan_isa(), "sse2")) return find_sse2;
+#endif
+        return nullptr;
+    }();
+    return kernel;
+}
+
+SearchPattern::SearchPattern(std::string text) : pattern(std::move(text)) {
+    size_t m = pattern.size();
+    std::fill(shift, shift + 256, m);
+    for(size_t i = 0; i + 1 < m; i++) {
+        shift[static_cast<unsigned char>(pattern[i])] = m - 1 - i;
+    }
+}
+
+size_t SearchPattern::horspool(const char* s, size_t n, size_t from) const {
+    size_t m = pattern.size();
+    unsigned char last = pattern[m - 1];
+    for(size_t i = from; i + m <= n; ) {
+        unsigned char c = s[i + m - 1];
+        if(c == last && !memcmp(s + i, pattern.data(), m - 1)) return i;
+        i += shift[c];
+    }
+    return npos;
+}
+
+size_t SearchPattern::find(std::string_view text, size_t from) const {
+    size_t m = pattern.size();
+    if(m == 0 || from >= text.size() || text.size() - from < m) return npos;
+    const char* s = text.data();
+    if(m == 1) {
+        const void* hit = memchr(s + from, pattern[0], text.size() - from);
+        return hit ? static_cast<const char*>(hit) - s : npos;
+    }
+    if(FindKernel kernel = find_kernel()) {
+        size_t pos = kernel(s, text.size(), pattern.data(), m, from);
+        if(pos != npos) return pos;
+    }
+    return horspool(s, text.size(), from);
+}
+
+size_t SearchPattern::find_last(std::string_view text, size_t before) const {
+    if(pattern.empty() || before == 0) return npos;
+    // Only matches that start before `before` can be in the prefix
+    text = text.substr(0, std::min(text.size(), before - 1 + pattern.size()));
+    size_t last = npos;
+    for(size_t pos = find(text); pos != npos; pos = find(text, pos + 1)) last = pos;
+    return last;
+}
+
+// Buffer search
+
+typedef TextBuffer::TextRun TextRun;
+
+static constexpr size_t CHUNK_BYTES = size_t(4) << 20;
+static constexpr size_t PARALLEL_BYTES = size_t(32) << 20;
+
+// Cuts runs longer than CHUNK_BYTES at line boundaries. Packed runs are
+// one block at most and stay whole.
+static void split_run(const TextRun& run, std::vector<TextRun>& out) {
+    if(run.bytes() <= CHUNK_BYTES) {
+        out.push_back(run);
+        return;
+    }
+    size_t i = 0;
+    while(i < run.lines) {
+        size_t start = run.line_start(i);
+        size_t lo = i + 1, hi = run.lines;
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo + 1) / 2;
+            if(run.line_start(mid) - start <= CHUNK_BYTES) lo = mid;
+            else hi = mid - 1;
+        }
+        size_t end = std::min(run.line_start(lo), run.text.size());
+        TextRun part = run;
+        part.y = run.y + i;
+        part.lines = lo - i;
+        part.text = run.text.substr(start, end - start);
+        part.first = run.first + i;
+        out.push_back(std::move(part));
+        i = lo;
+    }
+}
+
+struct SearchChunk {
+    size_t begin, end;  // runs
+};
+
+struct SearchHit {
+    size_t y, x;
+};
+
+// One search over the runs of a chunk, for the first match after the bound
+// or the last one before it.
+class ChunkSearch {
+public:
+    ChunkSearch(const std::vector<TextRun>& runs, const SearchPattern& pattern, bool forward) :
+        runs(runs), pattern(pattern), forward(forward) {}
+
+    bool scan(const SearchChunk& c, bool bounded, size_t by, size_t bx, SearchHit& found) const {
+        if(forward) {
+            for(size_t r = c.begin; r < c.end; r++) {
+                if(scan_run(runs[r], bounded, by, bx, found)) return true;
+            }
+        } else {
+            for(size_t r = c.end; r-- > c.begin; ) {
+                if(scan_run(runs[r], bounded, by, bx, found)) return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const std::vector<TextRun>& runs;
+    const SearchPattern& pattern;
+    bool forward;
+
+    bool scan_run(const TextRun& run, bool bounded, size_t by, size_t bx, SearchHit& found) const {
+        // Packed lines are decoded as they are reached, one block at a time
+        if(run.block && !run.keep) return scan_run(run.decoded(), bounded, by, bx, found);
+        size_t pos;
+        if(forward) {
+            size_t from = 0;
+            if(bounded) {
+                if(run.y + run.lines <= by) return false;
+                if(run.y <= by) from = run.line_start(by - run.y) + bx + 1;
+            }
+            pos = pattern.find(run.text, from);
+        } else {
+            size_t before = run.text.size() + 1;
+            if(bounded) {
+                if(run.y > by) return false;
+                if(run.y + run.lines > by) before = run.line_start(by - run.y) + bx;
+            }
+            pos = pattern.find_last(run.text, before);
+        }
+        if(pos == npos) return false;
+        run.position(pos, found.y, found.x);
+        return true;
+    }
+};
+
+bool search_buffer(const TextBuffer::Snapshot& text, const SearchPattern& pattern,
+                   size_t y, size_t x, bool forward,
+                   size_t& match_y, size_t& match_x, bool& wrapped) {
+    if(pattern.empty()) return false;
+
+    std::vector<TextRun> pieces, runs;
+    text.runs(pieces);
+    size_t total = 0;
+    for(const TextRun& run : pieces) {
+        split_run(run, runs);
+        total += run.bytes();
+    }
+
+    // Group runs (e.g. many short edited lines) into chunks of similar size
+    std::vector<SearchChunk> chunks;
+    size_t bytes = 0;
+    for(size_t r = 0; r < runs.size(); r++) {
+        if(chunks.empty() || bytes >= CHUNK_BYTES) {
+            chunks.push_back({r, r});
+            bytes = 0;
+        }
+        chunks.back().end = r + 1;
+        bytes += runs[r].bytes();
+    }
+    if(chunks.empty()) return false;
+
+    // The chunk holding the cursor is searched from the cursor on, then the
+    // others in search order, and finally the same chunk again in full to
+    // find matches on the far side of the cursor.
+    size_t home = 0;
+    while(home + 1 < chunks.size() && runs[chunks[home + 1].begin].y <= y) home++;
+    size_t count = chunks.size();
+    std::vector<size_t> order;
+    for(size_t i = 0; i <= count; i++) {
+        order.push_back(forward ? (home + i) % count : (home + count - i) % count);
+    }
+
+    ChunkSearch search(runs, pattern, forward);
+    std::vector<SearchHit> results(order.size());
+    std::atomic<size_t> best(order.size());
+    auto step = [&](size_t i) {
+        // Steps after a hit cannot be nearer
+        if(i > best.load(std::memory_order_relaxed)) return;
+        if(!search.scan(chunks[order[i]], i == 0, y, x, results[i])) return;
+        size_t b = best.load(std::memory_order_relaxed);
+        while(i < b && !best.compare_exchange_weak(b, i, std::memory_order_relaxed)) {}
+    };
+    if(total >= PARALLEL_BYTES) {
+        ThreadPool::shared().run(order.size(), step);
+    } else {
+        for(size_t i = 0; i < order.size() && best.load() == order.size(); i++) step(i);
+    }
+
+    size_t b = best.load();
+    if(b == order.size()) return false;
+    match_y = results[b].y;
+    match_x = results[b].x;
+    wrapped = forward ? (match_y < y || (match_y == y && match_x <= x))
+                      : (match_y > y || (match_y == y && match_x >= x));
+    return true;
+}
@@ -0,0 +1,151 @@
+#include "sidecar.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'T', 'I', 'D', 'E', 'I', 'D', 'X', '2'};
+// Bytes hashed at the start, middle and end of the file
+static const size_t SAMPLE_BYTES = 4096;
+
+static uint64_t fnv1a(const void* data, size_t size, uint64_t h = 14695981039346656037ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string cache_dir() {
+    if(const char* xdg = getenv("XDG_CACHE_HOME")) {
+        if(*xdg) return std::string(xdg) + "/tide";
+    }
+    if(const char* home = getenv("HOME")) {
+        if(*home) return std::string(home) + "/.cache/tide";
+    }
+    return "";
+}
+
+std::string Sidecar::path_of(const std::string& path) {
+    std::string dir = cache_dir();
+    if(dir.empty()) return "";
+    char resolved[PATH_MAX];
+    std::string absolute = realpath(path.c_str(), resolved) ? resolved : path;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.idx",
+             static_cast<unsigned long long>(fnv1a(absolute.data(), absolute.size())));
+    return dir + name;
+}
+
+uint64_t Sidecar::sample(const MappedFile& file) {
+    size_t size = file.size();
+    size_t n = std::min(size, SAMPLE_BYTES);
+    uint64_t h = fnv1a(&size, sizeof(size));
+    h = fnv1a(file.data(), n, h);
+    h = fnv1a(file.data() + (size - n) / 2, n, h);
+    return fnv1a(file.data() + size - n, n, h);
+}
+
+bool Sidecar::open(const std::string& path, const MappedFile& file) {
+    header = nullptr;
+    std::string sidecar = path_of(path);
+    if(sidecar.empty() || !map.open(sidecar) || map.size() < sizeof(Header)) return false;
+
+    const Header* h = reinterpret_cast<const Header*>(map.data());
+    bool valid = !memcmp(h->magic, MAGIC, sizeof(MAGIC)) &&
+                 h->size == file.size() && h->mtime == file.mtime() &&
+                 h->lines <= file.size() + 1 && h->runs <= h->lines &&
+                 map.size() == sizeof(Header) + (h->lines + 1 + h->runs) * sizeof(uint64_t) &&
+                 h->sample == sample(file);
+    if(!valid) {
+        map.close();
+        return false;
+    }
+    // line() trusts the offsets, so a stale or damaged table must not get
+    // through: they rise from 0 to the end of the file
+    const uint64_t* table = reinterpret_cast<const uint64_t*>(map.data() + sizeof(Header));
+    uint64_t end = table[h->lines];
+    bool rising = table[0] == 0;
+    for(uint64_t i = 0; i < h->lines; i++) rising &= table[i] < table[i + 1];
+    if(!rising || (end != file.size() && end != file.size() + 1)) {
+        map.close();
+        return false;
+    }
+    header = h;
+    return true;
+}
+
+const uint64_t* Sidecar::offsets() const {
+    return reinterpret_cast<const uint64_t*>(map.data() + sizeof(Header));
+}
+
+void Sidecar::states(std::vector<uint8_t>& out) const {
+    out.assign(lines(), 0);
+    if(!has_states()) return;
+    // Each run is (first line << 8 | state) and lasts until the next one
+    const uint64_t* runs = offsets() + header->lines + 1;
+    for(uint64_t r = 0; r < header->runs; r++) {
+        uint64_t first = std::min<uint64_t>(runs[r] >> 8, out.size());
+        uint64_t end = r + 1 < header->runs ? std::min<uint64_t>(runs[r + 1] >> 8, out.size())
+                                            : out.size();
+        if(first < end) std::fill(out.begin() + first, out.begin() + end, uint8_t(runs[r]));
+    }
+}
+
+// Creates dir and any missing parents.
+static bool make_dirs(const std::string& dir) {
+    for(size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+        std::string part = dir.substr(0, slash);
+        if(mkdir(part.c_str(), 0700) != 0 && errno != EEXIST) return false;
+        if(slash == std::string::npos) return true;
+    }
+}
+
+bool Sidecar::write(const std::string& path, const MappedFile& file,
+                    const LineIndex& index, const std::vector<uint8_t>& states) {
+    std::string target = path_of(path);
+    if(target.empty() || !index.done() || !make_dirs(cache_dir())) return false;
+
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.size = file.size();
+    h.mtime = file.mtime();
+    h.sample = sample(file);
+    h.lines = index.lines();
+    std::vector<uint64_t> runs;
+    if(states.size() == h.lines) {
+        for(size_t y = 0; y < states.size(); y++) {
+            if(y == 0 || states[y] != states[y - 1]) runs.push_back(uint64_t(y) << 8 | states[y]);
+        }
+    }
+    h.runs = runs.size();
+
+    // Written next to the target and renamed over it, so readers never
+    // map a partial sidecar
+    std::string temp = target + ".tmp" + std::to_string(getpid());
+    FILE* f = fopen(temp.c_str(), "wb");
+    if(!f) return false;
+    fwrite(&h, sizeof(h), 1, f);
+    std::vector<uint64_t> chunk;
+    chunk.reserve(8192);
+    for(size_t i = 0; i <= h.lines; i++) {
+        chunk.push_back(index.offset(i));
+        if(chunk.size() == chunk.capacity() || i == h.lines) {
+            fwrite(chunk.data(), sizeof(uint64_t), chunk.size(), f);
+            chunk.clear();
+        }
+    }
+    fwrite(runs.data(), sizeof(uint64_t), runs.size(), f);
+    bool ok = fflush(f) == 0 && !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if(!ok || rename(temp.c_str(), target.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
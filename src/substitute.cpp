@@ -0,0 +1,220 @@
+#include "substitute.hpp"
+#include <algorithm>
+#include <cctype>
+#include <regex>
+#include "search.hpp"
+#include "thread_pool.hpp"
+
+// Lines matched per task
+static const size_t CHUNK_LINES = 8192;
+
+static bool parse_address(const std::string& cmd, size_t& i, size_t cursor_y,
+                          size_t line_count, size_t& line) {
+    if(i >= cmd.size()) return false;
+    if(cmd[i] == '.') {
+        line = cursor_y;
+        i++;
+        return true;
+    }
+    if(cmd[i] == '$') {
+        line = line_count - 1;
+        i++;
+        return true;
+    }
+    if(!isdigit(static_cast<unsigned char>(cmd[i]))) return false;
+    size_t n = 0;
+    while(i < cmd.size() && isdigit(static_cast<unsigned char>(cmd[i]))) n = n * 10 + (cmd[i++] - '0');
+    line = n > 0 ? n - 1 : 0;
+    return true;
+}
+
+// Reads up to the next unescaped delimiter. An escaped delimiter becomes
+// the plain character; other escapes are kept for the regex or the
+// replacement to interpret.
+static std::string parse_field(const std::string& cmd, size_t& i, char delim) {
+    std::string out;
+    while(i < cmd.size() && cmd[i] != delim) {
+        if(cmd[i] == '\\' && i + 1 < cmd.size()) {
+            if(cmd[i + 1] != delim) out += '\\';
+            out += cmd[i + 1];
+            i += 2;
+        } else {
+            out += cmd[i++];
+        }
+    }
+    if(i < cmd.size()) i++;
+    return out;
+}
+
+bool Substitution::parse(const std::string& cmd, size_t cursor_y, size_t line_count,
+                         std::string& error) {
+    size_t i = 0;
+    if(cmd.compare(0, 1, "%") == 0) {
+        first = 0;
+        last = line_count - 1;
+        i = 1;
+    } else if(parse_address(cmd, i, cursor_y, line_count, first)) {
+        last = first;
+        if(i < cmd.size() && cmd[i] == ',') {
+            i++;
+            if(!parse_address(cmd, i, cursor_y, line_count, last)) {
+                error = "invalid range";
+                return true;
+            }
+        }
+    } else {
+        first = last = cursor_y;
+    }
+
+    // "s" followed by a delimiter that cannot start a word, so that e.g.
+    // "set" is not taken for a substitution
+    if(i + 1 >= cmd.size() || cmd[i] != 's') return false;
+    char delim = cmd[i + 1];
+    if(isalnum(static_cast<unsigned char>(delim)) || isspace(static_cast<unsigned char>(delim)) ||
+       delim == '\\' || delim == '"') {
+        return false;
+    }
+    i += 2;
+    pattern = parse_field(cmd, i, delim);
+    replacement = parse_field(cmd, i, delim);
+    global = false;
+    for(; i < cmd.size(); i++) {
+        if(cmd[i] == 'g') {
+            global = true;
+        } else {
+            error = std::string("unknown flag: ") + cmd[i];
+            return true;
+        }
+    }
+
+    if(first > last) std::swap(first, last);
+    if(last >= line_count) error = "invalid range";
+    return true;
+}
+
+// The replacement split into literal text and group references.
+struct ReplacementPart {
+    std::string text;
+    int group;  // -1 for literal text
+};
+
+static std::vector<ReplacementPart> compile_replacement(const std::string& rep) {
+    std::vector<ReplacementPart> parts;
+    auto literal = [&](char c) {
+        if(parts.empty() || parts.back().group >= 0) parts.push_back({{}, -1});
+        parts.back().text += c;
+    };
+    for(size_t i = 0; i < rep.size(); i++) {
+        char c = rep[i];
+        if(c == '&') {
+            parts.push_back({{}, 0});
+        } else if(c == '\\' && i + 1 < rep.size()) {
+            char n = rep[++i];
+            if(n >= '0' && n <= '9') parts.push_back({{}, n - '0'});
+            else if(n == 't') literal('\t');
+            else literal(n);
+        } else {
+            literal(c);
+        }
+    }
+    return parts;
+}
+
+static bool is_literal(const std::string& pattern) {
+    return pattern.find_first_of("\\^$.|?*+()[]{}") == std::string::npos;
+}
+
+// Appends the replacement for one match; group(k) returns the text of
+// group k of that match.
+template <typename Group>
+static void expand(const std::vector<ReplacementPart>& parts, std::string& out, Group group) {
+    for(const ReplacementPart& p : parts) {
+        if(p.group < 0) out += p.text;
+        else out += group(p.group);
+    }
+}
+
+bool run_substitution(const TextBuffer::Snapshot& text, const Substitution& s,
+                      SubstituteResult& result, std::string& error) {
+    if(s.pattern.empty()) {
+        error = "empty pattern";
+        return false;
+    }
+    std::vector<ReplacementPart> parts = compile_replacement(s.replacement);
+    bool literal = is_literal(s.pattern);
+    SearchPattern needle;
+    std::regex re;
+    if(literal) {
+        needle = SearchPattern(s.pattern);
+    } else {
+        try {
+            re.assign(s.pattern, std::regex::ECMAScript | std::regex::optimize);
+        } catch(const std::regex_error&) {
+            error = "invalid pattern: " + s.pattern;
+            return false;
+        }
+    }
+
+    size_t lines = s.last - s.first + 1;
+    size_t tasks = (lines + CHUNK_LINES - 1) / CHUNK_LINES;
+    std::vector<std::vector<TextBuffer::LineEdit>> edits(tasks);
+    std::vector<size_t> counts(tasks, 0);
+
+    auto rewrite_literal = [&](std::string_view line, std::string& out, size_t& n) {
+        size_t m = s.pattern.size();
+        size_t pos = needle.find(line);
+        if(pos == std::string_view::npos) return false;
+        size_t done = 0;
+        do {
+            out.append(line.substr(done, pos - done));
+            expand(parts, out, [&](int g) {
+                return g == 0 ? line.substr(pos, m) : std::string_view();
+            });
+            done = pos + m;
+            n++;
+        } while(s.global && (pos = needle.find(line, done)) != std::string_view::npos);
+        out.append(line.substr(done));
+        return true;
+    };
+
+    auto rewrite_regex = [&](std::string_view line, std::string& out, size_t& n) {
+        typedef std::regex_iterator<const char*> Matches;
+        const char* begin = line.data();
+        const char* end = begin + line.size();
+        const char* done = begin;
+        bool any = false;
+        for(Matches it(begin, end, re), stop; it != stop; ++it) {
+            const std::cmatch& m = *it;
+            out.append(done, m[0].first);
+            expand(parts, out, [&](int g) {
+                if(g >= static_cast<int>(m.size()) || !m[g].matched) return std::string_view();
+                return std::string_view(m[g].first, m[g].length());
+            });
+            done = m[0].second;
+            n++;
+            any = true;
+            if(!s.global) break;
+        }
+        if(any) out.append(done, end);
+        return any;
+    };
+
+    ThreadPool::shared().run(tasks, [&](size_t t) {
+        size_t from = s.first + t * CHUNK_LINES;
+        size_t to = std::min(from + CHUNK_LINES, s.last + 1);
+        std::string out;
+        for(size_t y = from; y < to; y++) {
+            std::string_view line = text.line(y);
+            out.clear();
+            bool changed = literal ? rewrite_literal(line, out, counts[t])
+                                   : rewrite_regex(line, out, counts[t]);
+            if(changed) edits[t].push_back({y, out});
+        }
+    });
+
+    for(size_t t = 0; t < tasks; t++) {
+        result.count += counts[t];
+        for(auto& e : edits[t]) result.lines.push_back(std::move(e));
+    }
+    return true;
+}
@@ -1,109 +1,155 @@
 #include "syntax.hpp"
+#include <algorithm>
+#include <cstring>
 #include "config.hpp"
-#include <cctype>
+#include "scan.hpp"
 
-SyntaxHighlighter::SyntaxHighlighter() {
-    cpp_keywords = {
-        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
-        "bool", "break", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
-        "class", "compl", "concept", "const", "consteval", "constexpr", "const_cast",
-        "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete",
-        "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
-        "false", "float", "for", "friend", "goto", "if", "inline", "int", "long",
-        "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator",
-        "or", "or_eq", "private", "protected", "public", "register", "reinterpret_cast",
-        "requires", "return", "short", "signed", "sizeof", "static", "static_assert",
-        "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
-        "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
-        "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"
-    };
-}
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIDE_SYNTAX_X86 1
+#endif
 
-std::vector<int> SyntaxHighlighter::highlight(const std::string& line, SyntaxState& state) {
-    std::vector<int> colors(line.size(), NORMAL);
+// A kernel skips the bytes from p[i] on that keep the state described by
+// `k`, in whole W-byte windows of p[0, n), and returns the first byte that
+// leaves it or where a scalar scan has to take over.
+typedef size_t (*SkipKernel)(const unsigned char* p, size_t i, size_t n, const Lexer::Skip& k);
 
-    for(size_t i = 0; i < line.size(); i++) {
-        if(state.in_comment) {
-            colors[i] = COMMENT;
-            if(i > 0 && line[i-1] == '*' && line[i] == '/') {
-                state.in_comment = false;
-            }
-            continue;
-        }
+#ifdef TIDE_SYNTAX_X86
 
-        if(state.in_string || state.in_char) {
-            colors[i] = STRING;
-            if(line[i] == '\\' && !state.escape) {
-                state.escape = true;
-            } else {
-                if((state.in_string && line[i] == '"') ||
-                   (state.in_char && line[i] == '\'')) {
-                    if(!state.escape) {
-                        state.in_string = false;
-                        state.in_char = false;
-                    }
-                }
-                state.escape = false;
-            }
-            continue;
-        }
+__attribute__((target("sse2")))
+static inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(hi - lo)), x);
+}
 
-        if(line[i] == '/' && i+1 < line.size()) {
-            if(line[i+1] == '/') {
-                std::fill(colors.begin()+i, colors.end(), COMMENT);
-                break;
-            }
-            if(line[i+1] == '*') {
-                state.in_comment = true;
-                colors[i] = COMMENT;
-                colors[i+1] = COMMENT;
-                i++;
-                continue;
-            }
-        }
+__attribute__((target("sse2")))
+static size_t skip_sse2(const unsigned char* p, size_t i, size_t n, const Lexer::Skip& k) {
+    __m128i bytes[Lexer::SKIP_BYTES];
+    for(size_t b = 0; b < k.count; b++) bytes[b] = _mm_set1_epi8(k.bytes[b]);
+    const uint32_t flip = k.until ? 0 : 0xffff;
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i in = _mm_setzero_si128();
+        if(k.letters) in = in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        if(k.digits) in = _mm_or_si128(in, in_range_sse2(v, '0', '9'));
+        for(size_t b = 0; b < k.count; b++) in = _mm_or_si128(in, _mm_cmpeq_epi8(v, bytes[b]));
+        uint32_t mask = _mm_movemask_epi8(in) ^ flip;
+        if(mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
 
-        if(line[i] == '"') {
-            state.in_string = true;
-            colors[i] = STRING;
-            continue;
-        }
+__attribute__((target("avx2")))
+static inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(hi - lo)), x);
+}
 
-        if(line[i] == '\'') {
-            state.in_char = true;
-            colors[i] = STRING;
-            continue;
-        }
+__attribute__((target("avx2")))
+static size_t skip_avx2(const unsigned char* p, size_t i, size_t n, const Lexer::Skip& k) {
+    __m256i bytes[Lexer::SKIP_BYTES];
+    for(size_t b = 0; b < k.count; b++) bytes[b] = _mm256_set1_epi8(k.bytes[b]);
+    const uint32_t flip = k.until ? 0 : 0xffffffff;
+    for(; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i in = _mm256_setzero_si256();
+        if(k.letters) in = in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        if(k.digits) in = _mm256_or_si256(in, in_range_avx2(v, '0', '9'));
+        for(size_t b = 0; b < k.count; b++) in = _mm256_or_si256(in, _mm256_cmpeq_epi8(v, bytes[b]));
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(in)) ^ flip;
+        if(mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
 
-        if(line[i] == '#') {
-            colors[i] = PREPROCESSOR;
-            size_t end = line.size();
-            std::fill(colors.begin()+i, colors.begin()+end, PREPROCESSOR);
-            break;
-        }
+#endif
+
+// Bytes of a run taken one at a time before the kernel is worth calling
+static constexpr size_t SKIP_AFTER = 16;
 
-        if(isdigit(line[i]) && (i == 0 || !isalnum(line[i-1]))) {
-            colors[i] = NUMBER;
-            size_t end = i + 1;
-            while(end < line.size() && (isdigit(line[end]) || line[end] == '.' || line[end] == 'x')) {
-                end++;
+static SkipKernel skip_kernel() {
+    // Follows scan_isa(), so TIDE_SCAN applies here too
+    static const SkipKernel kernel = [] () -> SkipKernel {
+#ifdef TIDE_SYNTAX_X86
+        if(!strcmp(scan_isa(), "avx2")) return skip_avx2;
+        if(!strcmp(scan_isa(), "sse2")) return skip_sse2;
+#endif
+        return nullptr;
+    }();
+    return kernel;
+}
+
+// Bytes that leave the state as it is, such as the text of a comment or a
+// word, are skipped with the SIMD kernel where the state's Skip fits one,
+// and otherwise by testing their class against the state's `stay` mask,
+// which does not wait on the previous byte. Other bytes take one table
+// lookup, and only transitions marked EVENT, where a token starts or ends,
+// touch the spans.
+void SyntaxHighlighter::highlight(std::string_view line, SyntaxState& state, std::vector<HighlightSpan>& out) {
+    const Lexer& lx = *lexer;
+    const size_t n = line.size();
+    const size_t first = out.size();
+    // Adjacent runs of the same color are merged into one span
+    auto fill = [&](size_t from, size_t to, int color) {
+        if(from >= to || color == NORMAL) return;
+        if(out.size() > first) {
+            HighlightSpan& last = out.back();
+            if(last.color == color && last.start + last.length == from) {
+                last.length += to - from;
+                return;
             }
-            std::fill(colors.begin()+i, colors.begin()+end, NUMBER);
-            i = end - 1;
-            continue;
         }
+        out.push_back({static_cast<uint32_t>(from), static_cast<uint32_t>(to - from),
+                       static_cast<uint8_t>(color)});
+    };
 
-        if(isalpha(line[i]) || line[i] == '_') {
-            size_t start = i;
-            while(i < line.size() && (isalnum(line[i]) || line[i] == '_')) {
-                i++;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(line.data());
+    uint8_t s = state.lexer < lx.states ? state.lexer : 0;
+    size_t run = 0;  // start of the current color
+    size_t word = 0;
+    int color = lx.color[s];
+    const SkipKernel kernel = skip_kernel();
+    size_t i = 0;
+    while(i < n) {
+        const uint32_t stay = lx.stay[s];
+        // Most runs are a short word or a blank; one that outlasts a SIMD
+        // window, like the body of a comment, is handed to the kernel
+        const size_t quick = kernel ? std::min(n, i + SKIP_AFTER) : n;
+        uint8_t k;
+        while(stay >> (k = lx.byte_class[p[i]]) & 1) {
+            if(++i == quick) break;
+        }
+        if(i == quick) {
+            if(i == n) break;
+            if(kernel && lx.skip[s].vector) i = kernel(p, i, n, lx.skip[s]);
+            while(i < n && stay >> (k = lx.byte_class[p[i]]) & 1) i++;
+            if(i == n) break;
+        }
+        uint8_t e = lx.next[s][k];
+        uint8_t t = e & Lexer::STATE;
+        if(e & Lexer::EVENT) {
+            size_t at = i - (e >> 7);
+            if(lx.flags[s] & Lexer::WORD && lx.keywords->contains(line.substr(word, i - word))) {
+                fill(word, i, KEYWORD);
+            }
+            if(lx.flags[t] & Lexer::WORD) word = i;
+            if(lx.color[t] != color) {
+                fill(run, at, color);
+                run = at;
+                color = lx.color[t];
             }
-            std::string word = line.substr(start, i - start);
-            if(cpp_keywords.count(word)) {
-                std::fill(colors.begin()+start, colors.begin()+i, KEYWORD);
+            if(lx.flags[t] & Lexer::REST) {
+                fill(at, n, color);
+                state.lexer = lx.eol[t];
+                return;
             }
-            i--;
-            continue;
         }
+        s = t;
+        i++;
+    }
+    if(lx.flags[s] & Lexer::WORD && lx.keywords->contains(line.substr(word, n - word))) {
+        fill(word, n, KEYWORD);
     }
-    return colors;
+    fill(run, n, color);
+    state.lexer = lx.eol[s];
 }
@@ -0,0 +1,81 @@
+#include "thread_pool.hpp"
+
+static size_t cores_but_one() {
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(cores_but_one());
+    return pool;
+}
+
+ThreadPool& ThreadPool::background() {
+    static ThreadPool pool(cores_but_one());
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t count) :
+    stop(false), generation(0), active(0), task(nullptr), tasks(0), next(0) {
+    for(size_t i = 0; i < count; i++) workers.emplace_back(&ThreadPool::loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for(std::thread& t : workers) t.join();
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& fn) {
+    if(workers.empty() || count <= 1) {
+        for(size_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> hold(serial);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        tasks = count;
+        next.store(0, std::memory_order_relaxed);
+        generation++;
+    }
+    wake.notify_all();
+    work();
+
+    // Workers that joined late may still be finishing their last task
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return active == 0; });
+    task = nullptr;
+    tasks = 0;
+}
+
+void ThreadPool::work() {
+    for(;;) {
+        size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if(i >= tasks) return;
+        (*task)(i);
+    }
+}
+
+void ThreadPool::loop() {
+    uint64_t seen = 0;
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || (generation != seen && task); });
+            if(stop) return;
+            seen = generation;
+            active++;
+        }
+        work();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+        }
+        idle.notify_all();
+    }
+}
@@ -1,58 +1,471 @@
 #include "tide.hpp"
-#include <sstream>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <malloc.h>
+#include <poll.h>
+#include <unistd.h>
 
 Tide::Tide(const char* filename) :
     cursor_x(0), cursor_y(0), filename(filename),
     show_line_numbers(SHOW_LINE_NUMBERS_DEFAULT),
-    should_exit(false) {
-    buffer.push_back("");
+    should_exit(false), syntax_cache(highlighter), line_num_width(0),
+    quit_after_save(false), undo(UNDO_BUDGET_DEFAULT), search_forward(true),
+    input_forward(true), perf_overlay(false), perf_win(nullptr), record_file(nullptr),
+    use_sidecar(SIDECAR_DEFAULT), sidecar_pending(false), follow_at_start(false),
+    recover_at_start(false), words_stale(true), completion(0), completion_x(0),
+    completion_win(nullptr), changes(0), saved_changes(0), saving_changes(0),
+    current_file(0), switch_clock(0), buffer_cap(BUFFER_CAP_DEFAULT), top_line(0), prev_cursor_y(0), drawn_lines(0),
+    full_redraw(true), gutter_dirty(true) {
     mode = COMMAND;
+    files.emplace_back();
+    files.back().filename = filename;
 }
 
-void Tide::run() {
-    initscr();
+// Journals of files left modified stay behind, so a quit by mistake can
+// still be undone with tide -r
+Tide::~Tide() {
+    if (journal && changes == saved_changes) journal->discard();
+    for (OpenFile& f : files) {
+        if (f.journal && f.changes == f.saved_changes) f.journal->discard();
+    }
+}
+
+void Tide::open_later(const std::string& path) {
+    files.emplace_back();
+    files.back().filename = path;
+}
+
+// Key codes for the bracketed paste markers, past the curses range
+static const int KEY_PASTE_BEGIN = KEY_MAX + 1;
+static const int KEY_PASTE_END = KEY_MAX + 2;
+// Keys read per batch before the screen is redrawn
+static const size_t INPUT_BATCH = 4096;
+// How long to wait for the rest of a paste that stalls
+static const int PASTE_TIMEOUT_MS = 200;
+
+void Tide::setup_screen() {
     raw();
     noecho();
     keypad(stdscr, TRUE);
+    idlok(stdscr, TRUE);
     curs_set(0);
-    start_color();
+    init_colors();
+    // Bracketed paste: the terminal wraps pasted text in ESC[200~ ESC[201~
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+}
+
+void Tide::run() {
+    setlocale(LC_ALL, "");
+    initscr();
+    setup_screen();
+    printf("\033[?2004h");
+    fflush(stdout);
+    load_file();
+    if (recover_at_start) recover_journal();
+    if (follow_at_start) set_follow_mode(true);
+    follow_at_start = false;  // applies to the first file only
+
+    // Frame latency runs from a key arriving to the frame that shows it
+    PerfTimer::Clock::time_point key_time;
+    bool key_pending = false;
+    while(!should_exit) {
+        check_save();
+        if (should_exit) break;
+        pack_lines();
+        index_words();
+        draw_frame();
+        if (key_pending && perf.enabled) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                PerfTimer::Clock::now() - key_time);
+            perf[PerfStats::FRAME].record(ns.count());
+        }
+        key_pending = false;
+
+        // Poll while background work can still change the screen, and wake
+        // up to sync the journal once typing pauses
+        bool busy = syntax_cache.busy() || buffer.indexing() || saver.running() ||
+                    follower.behind();
+        int wait = busy ? 20 : journal && journal->dirty() ? JOURNAL_IDLE_MS : -1;
+        timeout(wait);
+        if (follower.active() && !wait_for_key(wait)) continue;
+        int ch = getch();
+        if (ch == ERR) {
+            if (PerfTimer::Clock::now() - key_time >= std::chrono::milliseconds(JOURNAL_IDLE_MS)) {
+                sync_journal();
+            }
+            continue;
+        }
+        key_time = PerfTimer::Clock::now();
+        key_pending = true;
+        message.clear();
+
+        // Everything typed or pasted since the last frame is handled
+        // before the next one is drawn
+        PerfTimer timer(perf, PerfStats::INPUT);
+        keys.assign(1, ch);
+        timeout(0);
+        while (keys.size() < INPUT_BATCH && (ch = getch()) != ERR) keys.push_back(ch);
+        handle_keys();
+        if (record_file) write_keys(record_file);
+    }
+    printf("\033[?2004l");
+    fflush(stdout);
+    if (perf_win) delwin(perf_win);
+    endwin();
+    update_sidecar();
+    if (record_file) fclose(record_file);
+    write_perf_log();
+}
+
+bool Tide::set_record(const std::string& path) {
+    record_file = fopen(path.c_str(), "w");
+    if (!record_file) return false;
+    fprintf(record_file, "# tide keys: one input batch per line, as key codes\n");
+    return true;
+}
+
+// One line per batch, flushed so a session that crashes is still recorded
+void Tide::write_keys(FILE* f) const {
+    for (size_t i = 0; i < keys.size(); i++) fprintf(f, i ? " %d" : "%d", keys[i]);
+    fputc('\n', f);
+    fflush(f);
+}
 
+int Tide::replay(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "tide: cannot read %s\n", path.c_str());
+        return 1;
+    }
+    std::vector<std::vector<int>> batches;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::vector<int> batch;
+        const char* p = line.c_str();
+        char* end;
+        for (long key = strtol(p, &end, 10); end != p; key = strtol(p, &end, 10)) {
+            batch.push_back(static_cast<int>(key));
+            p = end;
+        }
+        if (!batch.empty()) batches.push_back(std::move(batch));
+    }
+
+    // A real curses screen whose output goes nowhere, sized by $LINES and
+    // $COLUMNS or else by the terminal type
+    setlocale(LC_ALL, "");
+    const char* term = getenv("TERM");
+    if (!term || !*term || !strcmp(term, "dumb")) term = "xterm-256color";
+    FILE* out = fopen("/dev/null", "w");
+    FILE* tty = fopen("/dev/null", "r");
+    SCREEN* screen = out && tty ? newterm(term, out, tty) : nullptr;
+    if (!screen) {
+        fprintf(stderr, "tide: cannot open a curses screen for %s\n", term);
+        if (out) fclose(out);
+        if (tty) fclose(tty);
+        return 1;
+    }
+    set_term(screen);
+    setup_screen();
+    load_file();
+    draw_frame();
+
+    // Same phases as a live session; FRAME spans a batch's keys through
+    // the refresh that shows them
+    perf.reset();
+    perf.enabled = true;
+    size_t key_count = 0, batch_count = 0;
+    for (const std::vector<int>& batch : batches) {
+        check_save();
+        if (should_exit) break;
+        PerfTimer frame(perf, PerfStats::FRAME);
+        pack_lines();
+        index_words();
+        message.clear();
+        keys = batch;
+        {
+            PerfTimer timer(perf, PerfStats::INPUT);
+            handle_keys();
+        }
+        draw_frame();
+        key_count += keys.size();
+        batch_count++;
+    }
+    // A :w near the end still lands on disk
+    while (saver.running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    check_save();
+
+    if (perf_win) delwin(perf_win);
+    endwin();
+    delscreen(screen);
+    fclose(out);
+    fclose(tty);
+    printf("# replayed %zu keys in %zu batches from %s\n", key_count, batch_count, path.c_str());
+    perf.dump(stdout);
+    write_perf_log();
+    return 0;
+}
+void Tide::draw_frame() {
+    {
+        PerfTimer timer(perf, PerfStats::SCROLL);
+        update_line_number_width();
+        scroll_to_cursor();
+    }
+    {
+        PerfTimer timer(perf, PerfStats::HIGHLIGHT);
+        syntax_cache.set_window(top_line, text_rows());
+        syntax_cache.update(buffer);
+    }
+    {
+        PerfTimer timer(perf, PerfStats::DRAW);
+        draw_line_numbers();
+        draw_buffer();
+        draw_status_bar();
+        draw_completion();
+        if (perf_overlay) draw_perf_overlay();
+    }
+    PerfTimer timer(perf, PerfStats::REFRESH);
+    wnoutrefresh(stdscr);
+    // Both stay on top of whatever stdscr redrew below them
+    if (completion_win) {
+        touchwin(completion_win);
+        wnoutrefresh(completion_win);
+    }
+    if (perf_win) {
+        touchwin(perf_win);
+        wnoutrefresh(perf_win);
+    }
+    doupdate();
+}
+
+void Tide::set_perf_log(const std::string& path) {
+    perf_log = path;
+    perf.enabled = true;
+}
+
+void Tide::set_perf_overlay(bool on) {
+    if (on && !perf.enabled) perf.reset();
+    perf_overlay = on;
+    perf.enabled = perf_overlay || !perf_log.empty();
+    if (!on && perf_win) {
+        delwin(perf_win);
+        perf_win = nullptr;
+    }
+}
+
+// Phase timings of the frames so far, in the top right corner: the last
+// frame and the p50/p99 over all of them, in milliseconds.
+void Tide::draw_perf_overlay() {
+    const int width = 38;
+    const int height = PerfStats::PHASES + 2;
+    int x = std::max(COLS - width, 0);
+    if (!perf_win) {
+        perf_win = newwin(height, width, 0, x);
+        wbkgd(perf_win, A_REVERSE);
+    }
+    if (getbegx(perf_win) != x) mvwin(perf_win, 0, x);
+
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    werase(perf_win);
+    mvwprintw(perf_win, 0, 0, " %-10s %7s %7s %7s", "perf (ms)", "last", "p50", "p99");
+    for (int p = 0; p < PerfStats::PHASES; p++) {
+        const Histogram& h = perf[static_cast<PerfStats::Phase>(p)];
+        mvwprintw(perf_win, p + 1, 0, " %-10s %7.2f %7.2f %7.2f",
+                  PerfStats::name(static_cast<PerfStats::Phase>(p)),
+                  ms(h.last()), ms(h.percentile(0.5)), ms(h.percentile(0.99)));
+    }
+    mvwprintw(perf_win, height - 1, 0, " %llu frames",
+              static_cast<unsigned long long>(perf[PerfStats::FRAME].count()));
+}
+
+void Tide::write_perf_log() {
+    if (perf_log.empty()) return;
+    FILE* f = fopen(perf_log.c_str(), "w");
+    if (!f) {
+        perror(perf_log.c_str());
+        return;
+    }
+    perf.dump(f);
+    fclose(f);
+}
+
+void Tide::init_colors() {
+    start_color();
     init_pair(NORMAL, COLOR_WHITE, COLOR_BLACK);
     init_pair(KEYWORD, COLOR_BLUE, COLOR_BLACK);
     init_pair(STRING, COLOR_GREEN, COLOR_BLACK);
     init_pair(COMMENT, COLOR_CYAN, COLOR_BLACK);
     init_pair(PREPROCESSOR, COLOR_MAGENTA, COLOR_BLACK);
     init_pair(NUMBER, COLOR_YELLOW, COLOR_BLACK);
+    init_pair(SEARCH, COLOR_BLACK, COLOR_YELLOW);
+}
 
-    load_file();
+// Ctrl-N and Ctrl-P, which complete words in insert mode
+static const int KEY_COMPLETE_NEXT = 14;
+static const int KEY_COMPLETE_PREV = 16;
 
-    while(!should_exit) {
-        update_line_number_width();
-        clear();
-        draw_line_numbers();
-        draw_buffer();
-        draw_status_bar();
-        refresh();
+// Text keys for insert mode, which arrive in runs when typing fast or
+// pasting without bracketed paste support.
+static bool is_text_key(int ch) {
+    return ch >= 0 && ch < 256 && ch != 27 && ch != 127 &&
+           ch != KEY_COMPLETE_NEXT && ch != KEY_COMPLETE_PREV;
+}
 
-        int ch = getch();
-        switch(mode) {
-            case COMMAND: handle_command_mode(ch); break;
-            case INSERT: handle_insert_mode(ch); break;
-            case EX: {
-                std::string ex_cmd;
-                handle_ex_mode(ex_cmd, ch);
-                break;
+void Tide::handle_keys() {
+    size_t i = 0;
+    while (i < keys.size() && !should_exit) {
+        int ch = keys[i++];
+        // Any other key keeps the word that was completed
+        if (!completions.empty() && ch != KEY_COMPLETE_NEXT && ch != KEY_COMPLETE_PREV) {
+            close_completion();
+        }
+        if (ch == KEY_RESIZE) {
+            full_redraw = true;
+        } else if (ch == KEY_PASTE_BEGIN) {
+            handle_paste(read_paste(i));
+        } else if (mode == INSERT && is_text_key(ch)) {
+            // A run of text is inserted at once, as one undo step
+            std::string text(1, static_cast<char>(ch));
+            while (i < keys.size() && is_text_key(keys[i])) text += static_cast<char>(keys[i++]);
+            if (cursor_x <= (int)buffer.line_length(cursor_y)) insert_text(cursor_y, cursor_x, text);
+        } else {
+            switch(mode) {
+                case COMMAND: handle_command_mode(ch); break;
+                case INSERT: handle_insert_mode(ch); break;
+                case EX: handle_ex_mode(ex_command, ch); break;
+                case SEARCH: handle_search_mode(ch); break;
             }
         }
     }
-    endwin();
 }
+
+// Collects a paste up to its end marker, first from keys[i...] and then
+// from the terminal, and leaves i after the marker.
+std::string Tide::read_paste(size_t& i) {
+    std::string text;
+    for (;;) {
+        if (i == keys.size()) {
+            // Kept in the batch so recordings hold the whole paste
+            timeout(PASTE_TIMEOUT_MS);
+            int ch = getch();
+            if (ch == ERR) break;  // the end marker got lost
+            keys.push_back(ch);
+        }
+        int ch = keys[i++];
+        if (ch == KEY_PASTE_END) break;
+        if (ch == '\r') ch = '\n';
+        if (ch >= 0 && ch < 256) text += static_cast<char>(ch);
+    }
+    return text;
+}
+
+// Pasted text goes into the buffer as one insert and one undo step, or
+// into the command line up to its first line break.
+void Tide::handle_paste(const std::string& text) {
+    if (text.empty()) return;
+    std::string first_line = text.substr(0, text.find('\n'));
+    switch(mode) {
+        case COMMAND:
+        case INSERT:
+            if (cursor_x > (int)buffer.line_length(cursor_y)) break;
+            undo.seal();
+            insert_text(cursor_y, cursor_x, text);
+            undo.seal();
+            break;
+        case EX:
+            ex_command += first_line;
+            break;
+        case SEARCH:
+            search_input += first_line;
+            set_highlight(SearchPattern(search_input));
+            break;
+    }
+}
+
 void Tide::handle_ex_command(const std::string& cmd) {
     if (cmd == "q") should_exit = true;
     else if (cmd == "w") save_file();
-    else if (cmd == "wq") { save_file(); should_exit = true; }
+    else if (cmd == "wq") quit_after_save = save_file();
     else if (cmd == "set number") show_line_numbers = true;
     else if (cmd == "set nonumber") show_line_numbers = false;
+    else if (cmd == "noh") set_highlight(SearchPattern());
+    else if (cmd == "bn") switch_file((current_file + 1) % files.size());
+    else if (cmd == "bp") switch_file((current_file + files.size() - 1) % files.size());
+    else if (cmd == "ls") list_files();
+    else if (cmd.compare(0, 2, "e ") == 0 && cmd.size() > 2) edit_file(cmd.substr(2));
+    else if (cmd.compare(0, 14, "set buffercap=") == 0) {
+        buffer_cap = std::strtoull(cmd.c_str() + 14, nullptr, 10) << 20;
+        evict_files();
+    }
+    else if (cmd == "follow") set_follow_mode(true);
+    else if (cmd == "nofollow") set_follow_mode(false);
+    else if (cmd == "set perf") set_perf_overlay(true);
+    else if (cmd == "set noperf") set_perf_overlay(false);
+    else if (cmd.compare(0, 15, "set undobudget=") == 0) {
+        undo.set_budget(std::strtoull(cmd.c_str() + 15, nullptr, 10) << 20);
+    }
+    else if (cmd == "$" || (!cmd.empty() && cmd.find_first_not_of("0123456789") == std::string::npos)) {
+        // Lines past the indexed part only exist once the index is done
+        size_t n = cmd == "$" ? SIZE_MAX : std::strtoull(cmd.c_str(), nullptr, 10);
+        if (n > buffer.line_count()) buffer.wait_for_index();
+        cursor_y = std::min(std::max<size_t>(n, 1), buffer.line_count()) - 1;
+        cursor_x = 0;
+    }
+    else {
+        Substitution s;
+        std::string error;
+        // % and $ and line numbers refer to the whole file, not the part
+        // indexed so far
+        buffer.wait_for_index();
+        if (!s.parse(cmd, cursor_y, buffer.line_count(), error)) {
+            message = "not an editor command: " + cmd;
+        } else if (!error.empty()) {
+            message = error;
+        } else {
+            substitute(std::move(s));
+        }
+    }
+    full_redraw = true;
+}
+
+// Matches on the worker threads, then applies every changed line to the
+// buffer in one batch that is also a single undo step.
+void Tide::substitute(Substitution s) {
+    // An empty pattern reuses the last search, as in vi
+    if (s.pattern.empty()) s.pattern = search.text();
+    if (s.pattern.empty()) {
+        message = "no previous search pattern";
+        return;
+    }
+    SubstituteResult result;
+    std::string error;
+    if (!run_substitution(buffer.snapshot(), s, result, error)) {
+        message = error;
+        return;
+    }
+    if (result.lines.empty()) {
+        message = "pattern not found: " + s.pattern;
+        return;
+    }
+
+    size_t changed = result.lines.size();
+    size_t last = result.lines.back().y;
+    undo.seal();
+    for (const TextBuffer::LineEdit& e : result.lines) {
+        undo.record_replace(e.y, buffer.line(e.y), e.text, cursor_y, cursor_x, last, 0);
+    }
+    undo.seal();
+    apply_lines(std::move(result.lines));
+    cursor_y = last;
+    cursor_x = 0;
+    message = std::to_string(result.count) + " substitutions on " +
+              std::to_string(changed) + " lines";
 }
 
 void Tide::handle_ex_mode(std::string& command, int ch) {
@@ -69,7 +482,949 @@ void Tide::handle_ex_mode(std::string& command, int ch) {
         command += static_cast<char>(ch);
     }
 }
-// [Rest of the implementations...]
-// Continue with other method implementations from previous versions
-// (load_file, save_file, draw_status_bar, etc)
-// Follow the same pattern as original code but using Tide class name
+
+// Matches of the pattern being typed are highlighted on every key; the
+// cursor only moves once it is confirmed with Enter.
+void Tide::handle_search_mode(int ch) {
+    if (ch == '\n') {
+        mode = COMMAND;
+        search_forward = input_forward;
+        if (search_input.empty()) {
+            // An empty pattern repeats the last search in the new direction
+            set_highlight(search);
+        } else {
+            search = highlight;
+        }
+        search_next(false);
+        return;
+    }
+    if (ch == 27) {  // ESC
+        mode = COMMAND;
+        set_highlight(search);
+        return;
+    }
+    if (ch == 127 || ch == KEY_BACKSPACE) {
+        if (search_input.empty()) {
+            mode = COMMAND;
+            set_highlight(search);
+            return;
+        }
+        search_input.pop_back();
+    } else if (ch >= 0 && ch < 256) {
+        search_input += static_cast<char>(ch);
+    }
+    set_highlight(SearchPattern(search_input));
+}
+
+void Tide::set_highlight(const SearchPattern& pattern) {
+    if (pattern.text() == highlight.text()) return;
+    highlight = pattern;
+    full_redraw = true;
+}
+
+// Moves to the next match in the search direction, or the opposite one
+// when `reverse` is set (N).
+void Tide::search_next(bool reverse) {
+    if (search.empty()) {
+        message = "no previous search pattern";
+        return;
+    }
+    set_highlight(search);
+    bool forward = search_forward != reverse;
+    size_t y, x;
+    bool wrapped;
+    if (!search_buffer(buffer.snapshot(), search, cursor_y, cursor_x, forward, y, x, wrapped)) {
+        message = "pattern not found: " + search.text();
+        return;
+    }
+    if (wrapped) {
+        message = forward ? "search hit BOTTOM, continuing at TOP"
+                          : "search hit TOP, continuing at BOTTOM";
+    }
+    cursor_y = y;
+    cursor_x = x;
+}
+
+void Tide::load_file() {
+    // A followed file may be truncated at any time, so it is not mapped
+    bool following = follower.active() || follow_at_start;
+    if (!buffer.load(filename, use_sidecar, following)) buffer.clear();
+    if (journal) journal->discard();
+    journal.reset(new Journal(filename));
+    if (access(journal->path().c_str(), F_OK) == 0) {
+        message = "found " + journal->path() + ", -r recovers it";
+    }
+    undo.clear();
+    changes = saved_changes = 0;
+    reset_views();
+
+    std::vector<uint8_t> states;
+    sidecar_pending = false;
+    if (buffer.sidecar_states(states)) syntax_cache.seed(std::move(states));
+    else sidecar_pending = use_sidecar && buffer.original_size() >= SIDECAR_MIN_BYTES;
+}
+
+bool Tide::set_follow_mode(bool on) {
+    if (!on) {
+        follower.stop();
+        return true;
+    }
+    // Readers of a mapping fault once the file shrinks under them, so from
+    // here on they read a copy
+    if (!buffer.copy_original()) {
+        message = "cannot follow " + filename + ": " + strerror(errno);
+        return false;
+    }
+    // Appends go after the last line, so the whole file must be indexed
+    buffer.wait_for_index();
+    if (!follower.start(filename, buffer.original_size())) {
+        message = "cannot follow " + filename + ": " + strerror(errno);
+        return false;
+    }
+    cursor_y = buffer.line_count() - 1;
+    cursor_x = 0;
+    sidecar_pending = false;  // the file on disk is about to move on
+    // The journal could not tell appends from edits; it stays off until
+    // the file is loaded again
+    if (journal) journal->discard();
+    journal.reset();
+    return true;
+}
+
+// Replays the journal left by a session that crashed on top of the file.
+void Tide::recover_journal() {
+    std::string error;
+    long edits = journal->recover(buffer, error);
+    if (edits < 0) {
+        message = error;
+        return;
+    }
+    undo.clear();
+    changes = saved_changes + 1;
+    sidecar_pending = false;
+    reset_views();
+    message = "recovered " + std::to_string(edits) + " edits from " + journal->path();
+}
+
+// Hands the journal records to the writer, compacting the journal instead
+// once it has outgrown the buffer it describes.
+void Tide::sync_journal() {
+    if (!journal) return;
+    if (journal->wants_compaction()) journal->compact(buffer.snapshot());
+    else journal->sync();
+}
+
+// Waits for the terminal and the followed file at once. Returns true if a
+// key can be read; appends that arrive meanwhile are applied.
+bool Tide::wait_for_key(int ms) {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {follower.fd(), POLLIN, 0}};
+    int ready = poll(fds, 2, ms);
+    if ((ready > 0 && fds[1].revents) || follower.behind()) follow_file();
+    return ready > 0 && fds[0].revents;
+}
+
+void Tide::follow_file() {
+    std::string text;
+    switch (follower.read(text)) {
+        case FileFollower::NONE:
+            break;
+        case FileFollower::RESET:
+            // Truncated or rotated: start over with what the path holds now
+            load_file();
+            set_follow_mode(true);
+            message = "\"" + filename + "\" reloaded";
+            break;
+        case FileFollower::APPENDED: {
+            // The view keeps up with the file while the cursor is on its end
+            size_t last = buffer.line_count() - 1;
+            bool at_end = (size_t)cursor_y == last;
+            // Text that is on disk does not make the buffer modified
+            bool clean = changes == saved_changes;
+            apply_insert(last, buffer.line_length(last), text);
+            if (clean) saved_changes = changes;
+            if (at_end) {
+                cursor_y = buffer.line_count() - 1;
+                cursor_x = 0;
+            }
+            break;
+        }
+    }
+}
+
+// Drops everything derived from the text of the previous buffer.
+void Tide::reset_views() {
+    highlighter.set_language(lexer_for(filename));
+    syntax_cache.reset();
+    layouts.reset();
+    recount_words();
+    full_redraw = true;
+}
+
+void Tide::edit_file(const std::string& path) {
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].filename == path) {
+            switch_file(i);
+            return;
+        }
+    }
+    open_later(path);
+    switch_file(files.size() - 1);
+}
+
+// Parks the current file with its text, undo history and cursor, and
+// makes file i current, loading it if it is a stub.
+void Tide::switch_file(size_t i) {
+    if (i == current_file) return;
+    if (saver.running()) {
+        message = "a save is in progress";
+        return;
+    }
+    set_follow_mode(false);
+
+    OpenFile& old = files[current_file];
+    old.cursor_x = cursor_x;
+    old.cursor_y = cursor_y;
+    old.top_line = top_line;
+    old.text.reset(new TextBuffer());
+    old.text->swap(buffer);
+    std::swap(old.undo, undo);
+    if (journal) journal->sync();
+    std::swap(old.journal, journal);
+    old.changes = changes;
+    old.saved_changes = saved_changes;
+    old.used = ++switch_clock;
+
+    current_file = i;
+    OpenFile& next = files[i];
+    filename = next.filename;
+    if (next.text) {
+        buffer.swap(*next.text);
+        next.text.reset();
+        std::swap(next.undo, undo);
+        std::swap(next.journal, journal);
+        changes = next.changes;
+        saved_changes = next.saved_changes;
+        reset_views();
+        std::vector<uint8_t> states;
+        if (changes == 0 && buffer.sidecar_states(states)) syntax_cache.seed(std::move(states));
+    } else {
+        load_file();
+    }
+    sidecar_pending = false;  // only kept up for the file opened first
+
+    if ((size_t)next.cursor_y >= buffer.line_count()) buffer.wait_for_index();
+    cursor_y = std::min<int>(next.cursor_y, buffer.line_count() - 1);
+    cursor_x = next.cursor_x;
+    top_line = std::min(next.top_line, cursor_y);
+    prev_cursor_y = cursor_y;
+    adjust_cursor_x();
+    evict_files();
+}
+
+// Unloads the least recently used unmodified files other than the current
+// one until the loaded files fit in buffer_cap. Their mappings are likely
+// still in the page cache, so loading them again is cheap.
+void Tide::evict_files() {
+    size_t total = buffer.memory() + undo.memory();
+    for (const OpenFile& f : files) {
+        if (f.text) total += f.text->memory() + f.undo.memory();
+    }
+    while (total > buffer_cap) {
+        OpenFile* victim = nullptr;
+        for (size_t i = 0; i < files.size(); i++) {
+            OpenFile& f = files[i];
+            if (i == current_file || !f.text || f.changes != f.saved_changes) continue;
+            if (!victim || f.used < victim->used) victim = &f;
+        }
+        if (!victim) break;
+        total -= victim->text->memory() + victim->undo.memory();
+        victim->text.reset();
+        victim->undo.clear();
+        if (victim->journal) victim->journal->discard();
+        victim->journal.reset();
+        victim->changes = victim->saved_changes = 0;
+    }
+}
+
+// :ls, with '%' on the current file, '+' on modified ones and '-' on
+// those not loaded.
+void Tide::list_files() {
+    message.clear();
+    for (size_t i = 0; i < files.size(); i++) {
+        const OpenFile& f = files[i];
+        bool modified = i == current_file ? changes != saved_changes : f.changes != f.saved_changes;
+        const char* mark = i == current_file ? "%" : modified ? "+" : f.text ? "" : "-";
+        message += (i ? "  " : "") + std::to_string(i + 1) + mark + " " + f.filename;
+    }
+}
+
+// Called on exit, so the write never holds up a frame. The syntax states
+// are stored if the worker got through the whole file, else the index
+// alone unless it came from a sidecar already.
+void Tide::update_sidecar() {
+    if (!sidecar_pending || buffer.indexing()) return;
+    std::vector<uint8_t> states;
+    if (!syntax_cache.file_states(buffer.line_count(), states) && buffer.from_sidecar()) return;
+    buffer.write_sidecar(filename, states);
+    sidecar_pending = false;
+}
+
+bool Tide::save_file() {
+    if (!saver.start(buffer.snapshot(), filename)) {
+        message = "a save is already in progress";
+        return false;
+    }
+    saving_text = buffer.snapshot();
+    if (journal) journal->save_started();
+    // The sidecar describes the file as loaded, which is about to change
+    sidecar_pending = false;
+    saving_changes = changes;
+    return true;
+}
+
+// Reports a save that finished in the background; a failed save cancels a
+// pending :wq so the buffer is not lost.
+void Tide::check_save() {
+    int error;
+    if (!saver.finished(error)) return;
+    if (journal) journal->save_finished(!error, std::move(saving_text));
+    saving_text = TextBuffer::Snapshot();
+    if (error) {
+        message = "save failed: " + std::string(strerror(error));
+        quit_after_save = false;
+        return;
+    }
+    message = "\"" + filename + "\" written";
+    saved_changes = saving_changes;
+    if (quit_after_save) should_exit = true;
+}
+
+// Compresses edited lines once enough of them pile up, keeping the ones
+// within a screen of the cursor loose since they are the likeliest to
+// change again.
+void Tide::pack_lines() {
+    if (buffer.loose_lines() < PACK_LOOSE_LINES) return;
+    int rows = text_rows();
+    size_t first = std::max(0, cursor_y - rows);
+    buffer.pack(first, cursor_y + rows + 1 - first);
+    // The freed lines are scattered through the heap; hand their pages back
+    malloc_trim(0);
+}
+
+// Starts counting the words of the buffer once its line index is done,
+// and takes the count when it is ready.
+void Tide::index_words() {
+    if (words_stale && !buffer.indexing()) {
+        words_stale = false;
+        words.rebuild(buffer.snapshot());
+    }
+    words.ready();
+}
+
+// For a new buffer, or an edit of so many lines that counting them one by
+// one would take longer than counting the whole buffer in the background.
+void Tide::recount_words() {
+    words.clear();
+    words_stale = true;
+}
+
+void Tide::update_line_number_width() {
+    int width = show_line_numbers ?
+        std::to_string(buffer.line_count()).length() + 2 : 0;
+    if (width != line_num_width) full_redraw = true;
+    line_num_width = width;
+}
+
+// Moves the viewport so the cursor is visible, scrolling the terminal
+// region instead of repainting when the jump is smaller than a screen.
+void Tide::scroll_to_cursor() {
+    int rows = text_rows();
+    if ((int)dirty_rows.size() != rows) full_redraw = true;
+
+    int new_top = top_line;
+    if (cursor_y < new_top) new_top = cursor_y;
+    else if (cursor_y >= new_top + rows) new_top = cursor_y - rows + 1;
+    int delta = new_top - top_line;
+    top_line = new_top;
+
+    if (full_redraw || std::abs(delta) >= rows) {
+        dirty_rows.assign(rows, true);
+        row_states.assign(rows, SyntaxState());
+        gutter_dirty = true;
+        full_redraw = false;
+    } else if (delta != 0) {
+        scroll_rows(0, delta);
+    }
+
+    // Lines that appeared or vanished at the end of the buffer
+    int count = buffer.line_count();
+    for (int y = std::min(count, drawn_lines); y < std::max(count, drawn_lines); y++) {
+        if (y >= top_line + rows) break;
+        mark_line_dirty(y);
+    }
+    drawn_lines = count;
+
+    mark_line_dirty(prev_cursor_y);
+    mark_line_dirty(cursor_y);
+    prev_cursor_y = cursor_y;
+}
+
+// Scrolls rows [from_row, text_rows()) by delta (positive moves content
+// up) and marks the exposed rows dirty.
+void Tide::scroll_rows(int from_row, int delta) {
+    int rows = text_rows();
+    int span = rows - from_row;
+    if (std::abs(delta) >= span) {
+        for (int r = from_row; r < rows; r++) dirty_rows[r] = true;
+        return;
+    }
+
+    scrollok(stdscr, TRUE);
+    setscrreg(from_row, rows - 1);
+    scrl(delta);
+    setscrreg(0, LINES - 1);
+    scrollok(stdscr, FALSE);
+
+    if (delta > 0) {
+        for (int r = from_row; r < rows - delta; r++) {
+            dirty_rows[r] = dirty_rows[r + delta];
+            row_states[r] = row_states[r + delta];
+        }
+        for (int r = rows - delta; r < rows; r++) dirty_rows[r] = true;
+    } else {
+        int d = -delta;
+        for (int r = rows - 1; r >= from_row + d; r--) {
+            dirty_rows[r] = dirty_rows[r - d];
+            row_states[r] = row_states[r - d];
+        }
+        for (int r = from_row; r < from_row + d; r++) dirty_rows[r] = true;
+    }
+}
+
+void Tide::mark_line_dirty(int y) {
+    int row = y - top_line;
+    if (row >= 0 && row < (int)dirty_rows.size()) dirty_rows[row] = true;
+}
+
+// Records that the lines starting at y moved by delta (inserted when
+// positive, removed when negative).
+void Tide::shift_lines(int y, int delta) {
+    int row = y - top_line;
+    gutter_dirty = true;
+    if (row < 0) {
+        full_redraw = true;
+        return;
+    }
+    if (row >= text_rows() || dirty_rows.empty()) return;
+    scroll_rows(row, -delta);
+}
+
+// Line y was modified and |delta| lines were inserted (delta > 0) or
+// removed (delta < 0) right after it.
+void Tide::lines_changed(int y, int delta) {
+    syntax_cache.line_changed(y);
+    layouts.line_changed(y);
+    if (delta > 0) {
+        syntax_cache.lines_inserted(y + 1, delta);
+        layouts.lines_inserted(y + 1, delta);
+    } else if (delta < 0) {
+        syntax_cache.lines_removed(y + 1, -delta);
+        layouts.lines_removed(y + 1, -delta);
+    }
+    mark_line_dirty(y);
+    if (delta != 0) shift_lines(y + 1, delta);
+}
+
+void Tide::draw_status_bar() {
+    if (mode == EX || mode == SEARCH) {
+        if (mode == EX) mvprintw(LINES-1, 0, ":%s", ex_command.c_str());
+        else mvprintw(LINES-1, 0, "%c%s", input_forward ? '/' : '?', search_input.c_str());
+        clrtoeol();
+        return;
+    }
+
+    attron(A_REVERSE);
+    std::string mode_str;
+    switch(mode) {
+        case COMMAND: mode_str = "COMMAND"; break;
+        case INSERT: mode_str = "INSERT"; break;
+        case EX: mode_str = "EX"; break;
+        case SEARCH: mode_str = "SEARCH"; break;
+    }
+    mvprintw(LINES-1, 0, " %s | %s%s | Line: %d Col: %d %s",
+            mode_str.c_str(), filename.c_str(), changes != saved_changes ? " [+]" : "",
+            cursor_y+1, cursor_x+1, buffer.indexing() ? "| indexing... " : "");
+    if (files.size() > 1) printw("| %zu/%zu ", current_file + 1, files.size());
+    if (saver.running()) printw("| saving %d%% ", saver.percent());
+    if (!message.empty()) printw("| %s ", message.c_str());
+    clrtoeol();
+    attroff(A_REVERSE);
+}
+
+void Tide::draw_line_numbers() {
+    if (!show_line_numbers) return;
+
+    int count = buffer.line_count();
+    attron(COLOR_PAIR(NORMAL) | A_DIM);
+    for (int row = 0; row < text_rows(); row++) {
+        if (!gutter_dirty && !dirty_rows[row]) continue;
+        int y = top_line + row;
+        if (y < count) mvprintw(row, 0, "%*d ", line_num_width - 1, y + 1);
+        else mvprintw(row, 0, "%*s", line_num_width, "");
+    }
+    attroff(COLOR_PAIR(NORMAL) | A_DIM);
+    gutter_dirty = false;
+}
+
+// Repaints only dirty rows, plus rows whose entry syntax state or spans
+// changed since they were painted (e.g. an edit opened a block comment
+// above, or the background highlighter delivered a result).
+void Tide::draw_buffer() {
+    int count = buffer.line_count();
+    layouts.set_window(top_line, text_rows());
+    for (int row = 0; row < text_rows(); row++) {
+        int y = top_line + row;
+        if (y < count) {
+            SyntaxState state = syntax_cache.state_at(buffer, y);
+            if (state != row_states[row]) {
+                row_states[row] = state;
+                dirty_rows[row] = true;
+            }
+            if (syntax_cache.take_repaint(y)) dirty_rows[row] = true;
+        }
+        if (dirty_rows[row]) draw_row(row);
+    }
+}
+
+// Each row is built into a reusable cell array with colors and the cursor
+// baked in, then written with a single addchnstr/add_wchnstr call.
+void Tide::draw_row(int row) {
+    int y = top_line + row;
+    dirty_rows[row] = false;
+    move(row, line_num_width);
+    if (y >= (int)buffer.line_count()) {
+        clrtoeol();
+        return;
+    }
+
+    std::string_view line = buffer.line(y);
+    const LineLayout& layout = layouts.layout(buffer, y);
+    HighlightCache::Spans spans = syntax_cache.spans(buffer, y);
+    row_matches.clear();
+    if (!highlight.empty()) {
+        uint32_t length = highlight.text().size();
+        for (size_t x = highlight.find(line); x != std::string_view::npos;
+             x = highlight.find(line, x + length)) {
+            row_matches.push_back({static_cast<uint32_t>(x), length, SEARCH});
+        }
+    }
+    int cursor = y == cursor_y ? cursor_x : -1;
+    int width = std::max(COLS - line_num_width, 0);
+    int columns = layout.plain ? draw_plain(line, spans, cursor, width)
+                               : draw_glyphs(line, layout, spans, cursor, width);
+    move(row, line_num_width + columns);
+    clrtoeol();
+}
+
+// Color of the byte at x; `span` only moves forward, so callers must ask
+// for increasing offsets.
+static int color_at(const HighlightSpan*& span, const HighlightSpan* end, size_t x) {
+    while (span != end && span->start + span->length <= x) span++;
+    if (span != end && span->start <= x) return span->color;
+    return NORMAL;
+}
+
+int Tide::draw_plain(std::string_view line, HighlightCache::Spans spans, int cursor, int width) {
+    int n = std::min((int)line.size(), width);
+    row_chars.resize(n + 1);
+    const HighlightSpan* span = spans.begin();
+    const HighlightSpan* match = row_matches.data();
+    const HighlightSpan* matches_end = match + row_matches.size();
+    for (int x = 0; x < n; x++) {
+        int color = color_at(span, spans.end(), x);
+        if (color_at(match, matches_end, x) == SEARCH) color = SEARCH;
+        chtype attr = COLOR_PAIR(color);
+        if (x == cursor) attr = A_REVERSE | COLOR_PAIR(NORMAL);
+        row_chars[x] = static_cast<unsigned char>(line[x]) | attr;
+    }
+    if (cursor >= (int)line.size() && n < width) {
+        row_chars[n++] = ' ' | A_REVERSE | COLOR_PAIR(NORMAL);
+    }
+    addchnstr(row_chars.data(), n);
+    return n;
+}
+
+int Tide::draw_glyphs(std::string_view line, const LineLayout& layout,
+                      HighlightCache::Spans spans, int cursor, int width) {
+    const std::vector<Glyph>& glyphs = layout.glyphs;
+    row_cells.resize(width + 1);
+    const HighlightSpan* span = spans.begin();
+    const HighlightSpan* match = row_matches.data();
+    const HighlightSpan* matches_end = match + row_matches.size();
+    int cells = 0, column = 0;
+    size_t g = 0;
+
+    auto put = [&](const wchar_t* text, attr_t attr, int color) {
+        setcchar(&row_cells[cells++], text, attr, color, nullptr);
+    };
+
+    while (g < glyphs.size()) {
+        const Glyph& glyph = glyphs[g];
+        if (column + glyph.width > width) break;
+        int color = color_at(span, spans.end(), glyph.byte);
+        if (color_at(match, matches_end, glyph.byte) == SEARCH) color = SEARCH;
+        attr_t attr = A_NORMAL;
+        size_t next = g + 1;
+        while (next < glyphs.size() && glyphs[next].width == 0) next++;
+        size_t end = next < glyphs.size() ? glyphs[next].byte : line.size();
+        if (cursor >= (int)glyph.byte && cursor < (int)end) {
+            attr = A_REVERSE;
+            color = NORMAL;
+        }
+
+        if (glyph.ch == '\t') {
+            for (int i = 0; i < glyph.width; i++) {
+                put(L" ", i == 0 ? attr : A_NORMAL, i == 0 ? color : NORMAL);
+            }
+        } else if (glyph.ch < 0x20 || glyph.ch == 0x7F) {
+            wchar_t key[] = { static_cast<wchar_t>(glyph.ch ^ 0x40), 0 };
+            put(L"^", attr, color);
+            put(key, attr, color);
+        } else {
+            // Combining marks share the cell of the character before them
+            wchar_t text[CCHARW_MAX + 1];
+            int len = 0;
+            text[len++] = glyph.ch;
+            for (size_t k = g + 1; k < next && len < CCHARW_MAX; k++) text[len++] = glyphs[k].ch;
+            text[len] = 0;
+            put(text, attr, color);
+        }
+        column += glyph.width;
+        g = next;
+    }
+    if (cursor >= (int)line.size() && column < width) {
+        put(L" ", A_REVERSE, NORMAL);
+        column++;
+    }
+    add_wchnstr(row_cells.data(), cells);
+    return column;
+}
+
+void Tide::handle_command_mode(int ch) {
+    undo.seal();
+    switch(ch) {
+        case 'i': mode = INSERT; break;
+        case ':': mode = EX; break;
+        case 'q': should_exit = true; break;
+        case 'u': undo_edit(); break;
+        case '/': case '?':
+            mode = SEARCH;
+            input_forward = ch == '/';
+            search_input.clear();
+            break;
+        case 'n': search_next(false); break;
+        case 'N': search_next(true); break;
+        case 18: redo_edit(); break;  // Ctrl-R
+
+        case KEY_UP:
+            if (cursor_y > 0) cursor_y--;
+            adjust_cursor_x();
+            break;
+        case KEY_DOWN:
+            if (cursor_y < (int)buffer.line_count()-1) cursor_y++;
+            adjust_cursor_x();
+            break;
+        case KEY_LEFT:
+            cursor_x = prev_char(buffer.line(cursor_y), cursor_x);
+            break;
+        case KEY_RIGHT:
+            cursor_x = next_char(buffer.line(cursor_y), cursor_x);
+            break;
+    }
+}
+
+void Tide::handle_insert_mode(int ch) {
+    // Typing, backspace and newline extend the current undo group; any
+    // other key ends it.
+    if (ch != 127 && ch != KEY_BACKSPACE && ch != '\n' &&
+        (ch < 0 || ch >= 256 || ch == 27)) {
+        undo.seal();
+    }
+    switch(ch) {
+        case 27: mode = COMMAND; break;
+        case KEY_COMPLETE_NEXT: complete_word(true); break;
+        case KEY_COMPLETE_PREV: complete_word(false); break;
+
+        case 127: case KEY_BACKSPACE:
+            handle_backspace();
+            break;
+
+        case '\n':
+            handle_newline();
+            break;
+
+        case KEY_UP:
+            if (cursor_y > 0) cursor_y--;
+            adjust_cursor_x();
+            break;
+        case KEY_DOWN:
+            if (cursor_y < (int)buffer.line_count()-1) cursor_y++;
+            adjust_cursor_x();
+            break;
+        case KEY_LEFT:
+            cursor_x = prev_char(buffer.line(cursor_y), cursor_x);
+            break;
+        case KEY_RIGHT:
+            cursor_x = next_char(buffer.line(cursor_y), cursor_x);
+            break;
+
+        default:
+            if (ch >= 0 && ch < 256 && cursor_x <= (int)buffer.line_length(cursor_y)) {
+                char c = static_cast<char>(ch);
+                insert_text(cursor_y, cursor_x, std::string_view(&c, 1));
+            }
+            break;
+    }
+}
+
+// Replaces the word before the cursor with the next or previous of the
+// words of the buffer that extend it, most frequent first, coming back to
+// what was typed after the last one.
+void Tide::complete_word(bool forward) {
+    if (completions.empty()) {
+        if (!words.ready()) {
+            message = "counting words...";
+            return;
+        }
+        std::string_view line = buffer.line(cursor_y);
+        int start = std::min(cursor_x, (int)line.size());
+        while (start > 0 && (isalnum((unsigned char)line[start-1]) || line[start-1] == '_')) start--;
+        int end = cursor_x;
+        while (end < (int)line.size() && (isalnum((unsigned char)line[end]) || line[end] == '_')) end++;
+        std::string prefix(line.substr(start, cursor_x - start));
+        // The word the cursor is in is not offered for itself
+        std::string current(line.substr(start, end - start));
+        words.remove_line(current);
+        words.complete(prefix, COMPLETION_ITEMS, completions);
+        words.add_line(current);
+        if (completions.empty()) {
+            message = "no completions";
+            return;
+        }
+        completions.insert(completions.begin(), prefix);
+        completion = 0;
+        completion_x = start;
+    }
+    size_t n = completions.size();
+    completion = forward ? (completion + 1) % n : (completion + n - 1) % n;
+    if (cursor_x > completion_x) erase_text(cursor_y, completion_x, cursor_y, cursor_x);
+    const std::string& word = completions[completion];
+    if (!word.empty()) insert_text(cursor_y, completion_x, word);
+}
+
+void Tide::close_completion() {
+    completions.clear();
+    if (!completion_win) return;
+    // The rows it covered are sent again on the next refresh
+    touchline(stdscr, getbegy(completion_win), getmaxy(completion_win));
+    delwin(completion_win);
+    completion_win = nullptr;
+}
+
+// The words offered by an open completion, below the word being completed
+// or above it when there is no room.
+void Tide::draw_completion() {
+    if (completions.empty()) return;
+    int width = 0;
+    for (size_t i = 1; i < completions.size(); i++) width = std::max(width, (int)completions[i].size());
+    width = std::min(width + 2, COLS);
+    int height = std::min((int)completions.size() - 1, text_rows());
+    int row = cursor_y - top_line;
+    int y = row + 1 + height <= text_rows() ? row + 1 : std::max(row - height, 0);
+    const LineLayout& layout = layouts.layout(buffer, cursor_y);
+    int column = completion_x;
+    if (!layout.plain) {
+        column = 0;
+        for (const Glyph& g : layout.glyphs) {
+            if (g.byte >= (uint32_t)completion_x) break;
+            column += g.width;
+        }
+    }
+    int x = std::max(std::min(line_num_width + column, COLS - width), 0);
+
+    if (completion_win && (getbegy(completion_win) != y || getbegx(completion_win) != x ||
+                           getmaxy(completion_win) != height || getmaxx(completion_win) != width)) {
+        touchline(stdscr, getbegy(completion_win), getmaxy(completion_win));
+        delwin(completion_win);
+        completion_win = nullptr;
+    }
+    if (!completion_win) completion_win = newwin(height, width, y, x);
+    if (!completion_win) return;
+    for (int i = 0; i < height; i++) {
+        wattrset(completion_win, (size_t)i + 1 == completion ? COLOR_PAIR(SEARCH) : A_REVERSE);
+        mvwprintw(completion_win, i, 0, " %-*.*s", width - 1, width - 1, completions[i + 1].c_str());
+    }
+}
+
+void Tide::adjust_cursor_x() {
+    std::string_view line = buffer.line(cursor_y);
+    cursor_x = char_start(line, std::min(cursor_x, (int)line.size()));
+}
+
+void Tide::handle_backspace() {
+    if (cursor_x > 0) {
+        int start = prev_char(buffer.line(cursor_y), cursor_x);
+        erase_text(cursor_y, start, cursor_y, cursor_x);
+    }
+    else if (cursor_y > 0) {
+        erase_text(cursor_y-1, buffer.line_length(cursor_y-1), cursor_y, 0);
+    }
+}
+
+void Tide::handle_newline() {
+    insert_text(cursor_y, cursor_x, "\n");
+}
+
+void Tide::apply_insert(size_t y, size_t x, std::string_view text) {
+    changes++;
+    if (journal) journal->insert(y, x, text);
+    size_t end_y, end_x;
+    UndoLog::end_of(y, x, text, end_y, end_x);
+    words.remove_line(buffer.line(y));
+    buffer.insert(y, x, text);
+    // The first and last lines mix old text with new; the lines between
+    // come from `text` alone and are counted straight from it
+    words.add_line(buffer.line(y));
+    if (end_y > y) {
+        size_t first = text.find('\n') + 1;
+        size_t last = text.rfind('\n');
+        if (first < last) words.add_lines(text.substr(first, last - first));
+        words.add_line(buffer.line(end_y));
+    }
+    lines_changed(y, end_y - y);
+}
+
+void Tide::apply_erase(size_t y, size_t x, size_t end_y, size_t end_x) {
+    changes++;
+    if (journal) journal->erase(y, x, end_y, end_x);
+    bool recount = end_y - y >= WORD_RECOUNT_LINES;
+    if (recount) {
+        recount_words();
+    } else {
+        for (size_t l = y; l <= end_y; l++) words.remove_line(buffer.line(l));
+    }
+    buffer.erase(y, x, end_y, end_x);
+    if (!recount) words.add_line(buffer.line(y));
+    lines_changed(y, -(int)(end_y - y));
+}
+
+// Replaces whole lines without changing the line count.
+void Tide::apply_lines(std::vector<TextBuffer::LineEdit> edits) {
+    if (edits.empty()) return;
+    changes++;
+    if (journal) journal->replace(edits);
+    if (edits.size() >= WORD_RECOUNT_LINES) {
+        recount_words();
+    } else {
+        for (const TextBuffer::LineEdit& e : edits) {
+            words.remove_line(buffer.line(e.y));
+            words.add_line(e.text);
+        }
+    }
+    int first = edits.front().y;
+    int count = edits.back().y - first + 1;
+    buffer.replace_lines(std::move(edits));
+    syntax_cache.lines_changed(first, count);
+    layouts.lines_changed(first, count);
+    int end = std::min(first + count, top_line + text_rows());
+    for (int y = std::max(first, top_line); y < end; y++) mark_line_dirty(y);
+}
+
+// Applies the REPLACE ops [from, to) of an undo group as one batch, with
+// the old lines when undoing and the new ones when redoing.
+void Tide::replay_replace(const std::vector<UndoLog::Op>& ops, size_t from, size_t to, bool undoing) {
+    std::vector<TextBuffer::LineEdit> edits;
+    edits.reserve(to - from);
+    for (size_t i = from; i < to; i++) {
+        std::string_view text = undoing ? ops[i].old_line() : ops[i].new_line();
+        edits.push_back({ops[i].y, std::string(text)});
+    }
+    apply_lines(std::move(edits));
+}
+
+// Inserts text at (y, x), records it for undo and leaves the cursor after it.
+void Tide::insert_text(size_t y, size_t x, std::string_view text) {
+    size_t before_y = cursor_y, before_x = cursor_x;
+    apply_insert(y, x, text);
+    size_t end_y, end_x;
+    UndoLog::end_of(y, x, text, end_y, end_x);
+    cursor_y = end_y;
+    cursor_x = end_x;
+    undo.record_insert(y, x, text, before_y, before_x, end_y, end_x);
+}
+
+// Erases the text between (y, x) and (end_y, end_x), records it for undo
+// and leaves the cursor at (y, x).
+void Tide::erase_text(size_t y, size_t x, size_t end_y, size_t end_x) {
+    size_t before_y = cursor_y, before_x = cursor_x;
+    std::string text = buffer.text(y, x, end_y, end_x);
+    apply_erase(y, x, end_y, end_x);
+    cursor_y = y;
+    cursor_x = x;
+    undo.record_erase(y, x, std::move(text), before_y, before_x, y, x);
+}
+
+void Tide::undo_edit() {
+    const UndoLog::Group* group = undo.undo();
+    if (!group) {
+        message = "already at oldest change";
+        return;
+    }
+    const std::vector<UndoLog::Op>& ops = group->ops;
+    for (size_t i = ops.size(); i-- > 0; ) {
+        const UndoLog::Op& op = ops[i];
+        if (op.kind == UndoLog::Op::REPLACE) {
+            // A run of line replacements goes back in one batch
+            size_t from = i;
+            while (from > 0 && ops[from - 1].kind == UndoLog::Op::REPLACE) from--;
+            replay_replace(ops, from, i + 1, true);
+            i = from;
+        } else if (op.kind == UndoLog::Op::INSERT) {
+            size_t end_y, end_x;
+            UndoLog::end_of(op.y, op.x, op.text, end_y, end_x);
+            apply_erase(op.y, op.x, end_y, end_x);
+        } else {
+            apply_insert(op.y, op.x, op.text);
+        }
+    }
+    cursor_y = group->before_y;
+    cursor_x = group->before_x;
+    adjust_cursor_x();
+}
+
+void Tide::redo_edit() {
+    const UndoLog::Group* group = undo.redo();
+    if (!group) {
+        message = "already at newest change";
+        return;
+    }
+    const std::vector<UndoLog::Op>& ops = group->ops;
+    for (size_t i = 0; i < ops.size(); i++) {
+        const UndoLog::Op& op = ops[i];
+        if (op.kind == UndoLog::Op::REPLACE) {
+            size_t to = i + 1;
+            while (to < ops.size() && ops[to].kind == UndoLog::Op::REPLACE) to++;
+            replay_replace(ops, i, to, false);
+            i = to - 1;
+        } else if (op.kind == UndoLog::Op::INSERT) {
+            apply_insert(op.y, op.x, op.text);
+        } else {
+            size_t end_y, end_x;
+            UndoLog::end_of(op.y, op.x, op.text, end_y, end_x);
+            apply_erase(op.y, op.x, end_y, end_x);
+        }
+    }
+    cursor_y = group->after_y;
+    cursor_x = group->after_x;
+    adjust_cursor_x();
+}
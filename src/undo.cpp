@@ -0,0 +1,135 @@
+#include "undo.hpp"
+
+UndoLog::UndoLog(size_t budget) : limit(budget), used(0), open(false) {
+}
+
+void UndoLog::set_budget(size_t bytes) {
+    limit = bytes;
+    trim();
+}
+
+void UndoLog::clear() {
+    done.clear();
+    undone.clear();
+    used = 0;
+    open = false;
+}
+
+void UndoLog::end_of(size_t y, size_t x, std::string_view text, size_t& end_y, size_t& end_x) {
+    size_t last = text.rfind('\n');
+    if(last == std::string_view::npos) {
+        end_y = y;
+        end_x = x + text.size();
+        return;
+    }
+    end_y = y;
+    for(char c : text) end_y += c == '\n';
+    end_x = text.size() - last - 1;
+}
+
+UndoLog::Group& UndoLog::current(size_t before_y, size_t before_x) {
+    // A new edit invalidates everything that was undone
+    for(const Group& g : undone) used -= g.bytes;
+    undone.clear();
+
+    if(!open || done.empty()) {
+        done.emplace_back();
+        done.back().before_y = before_y;
+        done.back().before_x = before_x;
+        done.back().bytes = sizeof(Group);
+        used += sizeof(Group);
+        open = true;
+    }
+    return done.back();
+}
+
+void UndoLog::charge(Group& g, size_t old_cost, size_t new_cost) {
+    g.bytes += new_cost - old_cost;
+    used += new_cost - old_cost;
+    trim();
+}
+
+void UndoLog::record_insert(size_t y, size_t x, std::string_view text,
+                            size_t before_y, size_t before_x, size_t after_y, size_t after_x) {
+    Group& g = current(before_y, before_x);
+    g.after_y = after_y;
+    g.after_x = after_x;
+
+    if(!g.ops.empty() && g.ops.back().kind == Op::INSERT) {
+        Op& last = g.ops.back();
+        size_t end_y, end_x;
+        end_of(last.y, last.x, last.text, end_y, end_x);
+        if(end_y == y && end_x == x) {
+            size_t old = cost(last);
+            last.text.append(text);
+            charge(g, old, cost(last));
+            return;
+        }
+    }
+    g.ops.push_back({Op::INSERT, y, x, std::string(text)});
+    charge(g, 0, cost(g.ops.back()));
+}
+
+void UndoLog::record_erase(size_t y, size_t x, std::string text,
+                           size_t before_y, size_t before_x, size_t after_y, size_t after_x) {
+    Group& g = current(before_y, before_x);
+    g.after_y = after_y;
+    g.after_x = after_x;
+
+    if(!g.ops.empty() && g.ops.back().kind == Op::ERASE) {
+        // Backspacing over the text right before the previous erase
+        Op& last = g.ops.back();
+        size_t end_y, end_x;
+        end_of(y, x, text, end_y, end_x);
+        if(end_y == last.y && end_x == last.x) {
+            size_t old = cost(last);
+            last.text.insert(0, text);
+            last.y = y;
+            last.x = x;
+            charge(g, old, cost(last));
+            return;
+        }
+    }
+    g.ops.push_back({Op::ERASE, y, x, std::move(text)});
+    charge(g, 0, cost(g.ops.back()));
+}
+
+void UndoLog::record_replace(size_t y, std::string_view old_line, std::string_view new_line,
+                             size_t before_y, size_t before_x, size_t after_y, size_t after_x) {
+    Group& g = current(before_y, before_x);
+    g.after_y = after_y;
+    g.after_x = after_x;
+    std::string text;
+    text.reserve(old_line.size() + new_line.size());
+    text.append(old_line).append(new_line);
+    g.ops.push_back({Op::REPLACE, y, old_line.size(), std::move(text)});
+    charge(g, 0, cost(g.ops.back()));
+}
+
+// Drops the oldest groups, undone ones first, until the log fits.
+void UndoLog::trim() {
+    while(used > limit && !undone.empty()) {
+        used -= undone.front().bytes;
+        undone.erase(undone.begin());
+    }
+    while(used > limit && done.size() > 1) {
+        used -= done.front().bytes;
+        done.pop_front();
+    }
+}
+
+const UndoLog::Group* UndoLog::undo() {
+    open = false;
+    if(done.empty()) return nullptr;
+    undone.push_back(std::move(done.back()));
+    done.pop_back();
+    return &undone.back();
+}
+
+const UndoLog::Group* UndoLog::redo() {
+    open = false;
+    if(undone.empty()) return nullptr;
+    done.push_back(std::move(undone.back()));
+    undone.pop_back();
+    return &done.back();
+}
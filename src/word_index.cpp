@@ -0,0 +1,272 @@
+#include "word_index.hpp"
+#include <algorithm>
+#include <queue>
+
+WordTrie::WordTrie() : nodes(1), words(0) {
+}
+
+uint32_t WordTrie::make(std::string label, uint32_t parent) {
+    uint32_t n;
+    if(!free_nodes.empty()) {
+        n = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[n] = Node();
+    } else {
+        n = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+    }
+    nodes[n].label = std::move(label);
+    nodes[n].parent = parent;
+    return n;
+}
+
+// Index in nodes[n].children of the child whose label starts with `first`,
+// or of where it would go.
+size_t WordTrie::child_slot(uint32_t n, char first) const {
+    const std::vector<uint32_t>& children = nodes[n].children;
+    auto it = std::lower_bound(children.begin(), children.end(), first,
+                               [&](uint32_t c, char b) { return nodes[c].label[0] < b; });
+    return it - children.begin();
+}
+
+void WordTrie::add(std::string_view word, long delta) {
+    if(word.empty() || delta == 0) return;
+    uint32_t n = 0;
+    size_t i = 0;
+    while(i < word.size()) {
+        size_t slot = child_slot(n, word[i]);
+        std::vector<uint32_t>& children = nodes[n].children;
+        if(slot == children.size() || nodes[children[slot]].label[0] != word[i]) {
+            if(delta < 0) return;
+            uint32_t leaf = make(std::string(word.substr(i)), n);
+            nodes[n].children.insert(nodes[n].children.begin() + slot, leaf);
+            n = leaf;
+            break;
+        }
+        uint32_t c = children[slot];
+        const std::string& label = nodes[c].label;
+        size_t common = 0;
+        while(common < label.size() && i + common < word.size() &&
+              label[common] == word[i + common]) {
+            common++;
+        }
+        if(common < label.size()) {
+            if(delta < 0) return;
+            // The word ends or branches off inside the edge: split it
+            uint32_t mid = make(label.substr(0, common), n);
+            nodes[c].label.erase(0, common);
+            nodes[c].parent = mid;
+            nodes[mid].children.push_back(c);
+            nodes[mid].best = nodes[c].best;
+            nodes[n].children[slot] = mid;
+            c = mid;
+        }
+        n = c;
+        i += common;
+    }
+
+    Node& node = nodes[n];
+    if(delta < 0 && node.count == 0) return;
+    if(node.count == 0) words++;
+    if(delta < 0 && node.count <= static_cast<unsigned long>(-delta)) node.count = 0;
+    else node.count = static_cast<uint32_t>(node.count + delta);
+    if(node.count == 0) words--;
+    update(n);
+}
+
+// Recomputes `best` from n up, after dropping nodes that no longer lead
+// to any word.
+void WordTrie::update(uint32_t n) {
+    while(n != 0 && nodes[n].count == 0 && nodes[n].children.size() < 2) {
+        uint32_t parent = nodes[n].parent;
+        std::vector<uint32_t>& siblings = nodes[parent].children;
+        size_t slot = child_slot(parent, nodes[n].label[0]);
+        if(nodes[n].children.empty()) {
+            siblings.erase(siblings.begin() + slot);
+        } else {
+            // A lone child takes the place of its parent
+            uint32_t c = nodes[n].children[0];
+            nodes[c].label.insert(0, nodes[n].label);
+            nodes[c].parent = parent;
+            siblings[slot] = c;
+        }
+        nodes[n] = Node();
+        free_nodes.push_back(n);
+        n = parent;
+    }
+    for(;;) {
+        uint32_t best = nodes[n].count;
+        for(uint32_t c : nodes[n].children) best = std::max(best, nodes[c].best);
+        if(best == nodes[n].best && n != 0) break;
+        nodes[n].best = best;
+        if(n == 0) break;
+        n = nodes[n].parent;
+    }
+}
+
+std::string WordTrie::word_of(uint32_t n) const {
+    std::vector<uint32_t> path;
+    size_t length = 0;
+    for(; n != 0; n = nodes[n].parent) {
+        path.push_back(n);
+        length += nodes[n].label.size();
+    }
+    std::string word;
+    word.reserve(length);
+    for(size_t i = path.size(); i-- > 0; ) word += nodes[path[i]].label;
+    return word;
+}
+
+void WordTrie::complete(std::string_view prefix, size_t max, std::vector<std::string>& out) const {
+    out.clear();
+    uint32_t n = 0;
+    size_t i = 0;
+    while(i < prefix.size()) {
+        size_t slot = child_slot(n, prefix[i]);
+        const std::vector<uint32_t>& children = nodes[n].children;
+        if(slot == children.size()) return;
+        uint32_t c = children[slot];
+        const std::string& label = nodes[c].label;
+        size_t common = 0;
+        while(common < label.size() && i + common < prefix.size() &&
+              label[common] == prefix[i + common]) {
+            common++;
+        }
+        if(common < label.size() && i + common < prefix.size()) return;
+        n = c;
+        i += common;
+    }
+
+    // Best first: a subtree is opened when its best count is the largest
+    // left, and a word is taken when its own count is. Ties go to what was
+    // queued first, so shorter words come before longer ones.
+    struct Item {
+        uint32_t priority;
+        uint32_t order;
+        uint32_t node;
+        bool word;
+        bool operator<(const Item& o) const {
+            return priority != o.priority ? priority < o.priority : order > o.order;
+        }
+    };
+    std::priority_queue<Item> queue;
+    uint32_t order = 0;
+    if(nodes[n].best) queue.push({nodes[n].best, order++, n, false});
+    std::vector<std::pair<uint32_t, std::string>> found;
+    while(!queue.empty() && found.size() < max) {
+        Item item = queue.top();
+        queue.pop();
+        if(item.word) {
+            std::string word = word_of(item.node);
+            if(word.size() > prefix.size()) found.emplace_back(item.priority, std::move(word));
+            continue;
+        }
+        const Node& node = nodes[item.node];
+        if(node.count) queue.push({node.count, order++, item.node, true});
+        for(uint32_t c : node.children) queue.push({nodes[c].best, order++, c, false});
+    }
+    std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+        if(a.first != b.first) return a.first > b.first;
+        if(a.second.size() != b.second.size()) return a.second.size() < b.second.size();
+        return a.second < b.second;
+    });
+    for(auto& f : found) out.push_back(std::move(f.second));
+}
+
+WordIndex::WordIndex() : state(IDLE), cancel(false), finished(false) {
+}
+
+WordIndex::~WordIndex() {
+    stop();
+}
+
+void WordIndex::stop() {
+    if(!thread.joinable()) return;
+    cancel.store(true, std::memory_order_relaxed);
+    thread.join();
+    built.reset();
+}
+
+void WordIndex::clear() {
+    stop();
+    trie = WordTrie();
+    pending.clear();
+    state = IDLE;
+}
+
+void WordIndex::rebuild(TextBuffer::Snapshot text) {
+    clear();
+    state = BUILDING;
+    cancel.store(false, std::memory_order_relaxed);
+    finished.store(false, std::memory_order_relaxed);
+    thread = std::thread([this, text = std::move(text)] { build(text); });
+}
+
+void WordIndex::build(const TextBuffer::Snapshot& text) {
+    // The snapshot keeps the file and the edited lines alive, so their
+    // words are counted by view. Packed lines are decoded a block at a
+    // time, and their words copied before the block goes.
+    std::vector<TextBuffer::TextRun> runs;
+    text.runs(runs);
+    std::unordered_map<std::string_view, long> counts;
+    std::unordered_map<std::string, long> packed;
+    for(const TextBuffer::TextRun& run : runs) {
+        if(cancel.load(std::memory_order_relaxed)) return;
+        if(run.block) {
+            TextBuffer::TextRun block = run.decoded();
+            std::unordered_map<std::string_view, long> words;
+            for_each_word(block.text, [&](std::string_view word) { words[word]++; });
+            for(const auto& word : words) packed[std::string(word.first)] += word.second;
+            continue;
+        }
+        // Long runs of the file are taken in slices to notice a cancel
+        const size_t slice = size_t(1) << 20;
+        for(size_t at = 0; at < run.text.size(); ) {
+            size_t end = std::min(at + slice, run.text.size());
+            while(end < run.text.size() && run.text[end - 1] != '\n') end++;
+            for_each_word(run.text.substr(at, end - at), [&](std::string_view word) { counts[word]++; });
+            at = end;
+            if(cancel.load(std::memory_order_relaxed)) return;
+        }
+    }
+    std::unique_ptr<WordTrie> result(new WordTrie());
+    size_t added = 0;
+    for(const auto& word : counts) {
+        result->add(word.first, word.second);
+        if(++added % 65536 == 0 && cancel.load(std::memory_order_relaxed)) return;
+    }
+    for(const auto& word : packed) result->add(word.first, word.second);
+    built = std::move(result);
+    finished.store(true, std::memory_order_release);
+}
+
+bool WordIndex::ready() {
+    if(state == BUILDING && finished.load(std::memory_order_acquire)) {
+        thread.join();
+        trie = std::move(*built);
+        built.reset();
+        for(const auto& word : pending) trie.add(word.first, word.second);
+        pending.clear();
+        state = READY;
+    }
+    return state == READY;
+}
+
+void WordIndex::count_line(std::string_view line, long delta) {
+    if(state == IDLE) return;
+    if(state == READY) {
+        for_each_word(line, [&](std::string_view word) { trie.add(word, delta); });
+    } else {
+        for_each_word(line, [&](std::string_view word) { pending[std::string(word)] += delta; });
+    }
+}
+
+void WordIndex::add_lines(std::string_view text) {
+    if(state == IDLE) return;
+    std::unordered_map<std::string_view, long> counts;
+    for_each_word(text, [&](std::string_view word) { counts[word]++; });
+    for(const auto& word : counts) {
+        if(state == READY) trie.add(word.first, word.second);
+        else pending[std::string(word.first)] += word.second;
+    }
+}